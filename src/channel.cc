@@ -2,6 +2,8 @@
 #include "user.h"
 #include "connection.h"
 #include "context.h"
+#include "userlistmodel.h"
+#include <QTimer>
 
 // ============================================================================
 //
@@ -9,11 +11,16 @@ IRCChannel::IRCChannel (IRCConnection* conn, const QString& newname) :
 	name (newname),
 	joinTime (QTime::currentTime()),
 	connection (conn),
-	isDoneWithNames (true)
+	isDoneWithNames (true),
+	userlistModel (new UserlistModel (this)),
+	userlistBatchDepth (0),
+	isUserlistFlushScheduled (false)
 {
+	connect (this, SIGNAL (userlistChanged (UserlistDelta)),
+		userlistModel, SLOT (applyDelta (UserlistDelta)));
 	context = new Context (this);
 	connection->addChannel (this);
-	connection->write (format ("WHO %1\n", name));
+	connection->write (format ("WHO %1\n", name), SendPriority_Bulk);
 }
 
 // ============================================================================
@@ -21,10 +28,12 @@ IRCChannel::IRCChannel (IRCConnection* conn, const QString& newname) :
 IRCChannel::~IRCChannel()
 {
 	delete context;
+	connection->removeChannel (this);
 
-	for (const UserlistEntry& e : userlist)
+	for (UserlistEntry* e : userlist)
 	{
-		IRCUser* user = e.userInfo;
+		IRCUser* user = e->userInfo;
+		delete e;
 		user->dropKnownChannel (this);
 	}
 }
@@ -33,54 +42,181 @@ IRCChannel::~IRCChannel()
 //
 UserlistEntry* IRCChannel::addUser (IRCUser* info)
 {
-	UserlistEntry e (info, FNormal);
-	info->addKnownChannel (this);
-	userlist << e;
-	emit userlistChanged();
-	return &userlist.last();
+	UserlistEntry* e = insertEntry (info, FNormal);
+	UserlistDelta delta;
+	delta.added << info;
+	announce (delta);
+	return e;
 }
 
 // ============================================================================
 //
-void IRCChannel::removeUser (IRCUser* info)
+// Merges the changes of @other into this delta. Removals cancel out earlier
+// additions and changes of the same users, and changes to users who are being
+// added are redundant.
+//
+void UserlistDelta::merge (const UserlistDelta& other)
 {
-	info->dropKnownChannel (this);
+	for (IRCUser* user : other.removed)
+	{
+		changed.removeOne (user);
 
-	for (const UserlistEntry& e : userlist)
+		if (added.removeOne (user) == false)
+			removed << user;
+	}
+
+	for (IRCUser* user : other.changed)
 	{
-		if (e.userInfo == info)
-		{
-			userlist.removeOne (e);
-			emit userlistChanged();
-			return;
-		}
+		if (added.contains (user) == false && changed.contains (user) == false)
+			changed << user;
 	}
+
+	added << other.added;
 }
 
 // ============================================================================
 //
-UserlistEntry* IRCChannel::findUserByName (QString name)
+// Queues @delta to be announced. Additions and changes are announced once per
+// event loop turn, merged together, or once a batch of changes is over.
+// Removals are announced right away, since the removed users may be pruned
+// before the queued changes are delivered.
+//
+void IRCChannel::announce (const UserlistDelta& delta)
 {
-	for (UserlistEntry & e : userlist)
+	if (delta.removed.isEmpty() == false)
 	{
-		if (e.userInfo->nickname == name)
-			return &e;
+		UserlistDelta removal;
+		removal.removed = delta.removed;
+		pendingDelta.merge (removal);
+		pendingDelta.removed.clear();
+		emit userlistChanged (removal);
 	}
 
-	return null;
+	UserlistDelta rest (delta);
+	rest.removed.clear();
+
+	if (rest.isEmpty())
+		return;
+
+	pendingDelta.merge (rest);
+
+	if (userlistBatchDepth == 0 && isUserlistFlushScheduled == false)
+	{
+		isUserlistFlushScheduled = true;
+		QTimer::singleShot (0, this, SLOT (flushUserlistChanges()));
+	}
 }
 
 // ============================================================================
 //
-UserlistEntry* IRCChannel::findUser (IRCUser* info)
+void IRCChannel::flushUserlistChanges() // [slot]
 {
-	for (UserlistEntry & e : userlist)
+	isUserlistFlushScheduled = false;
+
+	if (userlistBatchDepth > 0 || pendingDelta.isEmpty())
+		return;
+
+	UserlistDelta delta;
+	qSwap (delta, pendingDelta);
+	emit userlistChanged (delta);
+}
+
+// ============================================================================
+//
+// Starts a batch of userlist changes, e.g. a netsplit. Changes are announced
+// as one when the batch ends. Batches may nest.
+//
+void IRCChannel::beginUserlistBatch()
+{
+	userlistBatchDepth++;
+}
+
+// ============================================================================
+//
+void IRCChannel::endUserlistBatch()
+{
+	if (userlistBatchDepth == 0 || --userlistBatchDepth > 0)
+		return;
+
+	if (pendingDelta.isEmpty() == false && isUserlistFlushScheduled == false)
 	{
-		if (e.userInfo == info)
-			return &e;
+		isUserlistFlushScheduled = true;
+		QTimer::singleShot (0, this, SLOT (flushUserlistChanges()));
 	}
+}
+
+// ============================================================================
+//
+UserlistEntry* IRCChannel::insertEntry (IRCUser* info, FStatusFlags status)
+{
+	UserlistEntry* e = new UserlistEntry (info, status);
+	info->addKnownChannel (this);
+	userlist.insert (info, e);
+	userlistByName.insert (connection->foldCase (info->nickname), e);
+	return e;
+}
+
+// ============================================================================
+//
+void IRCChannel::removeUser (IRCUser* info)
+{
+	UserlistEntry* e = userlist.take (info);
+
+	if (e != null)
+	{
+		userlistByName.remove (connection->foldCase (info->nickname));
+		delete e;
+		UserlistDelta delta;
+		delta.removed << info;
+		announce (delta);
+	}
+
+	// Do this last, it may prune the user.
+	info->dropKnownChannel (this);
+}
+
+// ============================================================================
+//
+// Moves @info in the name index after a nickname change.
+//
+void IRCChannel::userRenamed (IRCUser* info, const QString& oldnick)
+{
+	UserlistEntry* e = userlist.value (info);
+
+	if (e == null)
+		return;
+
+	userlistByName.remove (connection->foldCase (oldnick));
+	userlistByName.insert (connection->foldCase (info->nickname), e);
+	UserlistDelta delta;
+	delta.changed << info;
+	announce (delta);
+}
+
+// ============================================================================
+//
+// Rebuilds the name index, needed if the casemapping of the network changes.
+//
+void IRCChannel::rebuildNameIndex()
+{
+	userlistByName.clear();
+
+	for (UserlistEntry* e : userlist)
+		userlistByName.insert (connection->foldCase (e->userInfo->nickname), e);
+}
+
+// ============================================================================
+//
+UserlistEntry* IRCChannel::findUserByName (const QString& name)
+{
+	return userlistByName.value (connection->foldCase (name));
+}
 
-	return null;
+// ============================================================================
+//
+UserlistEntry* IRCChannel::findUser (IRCUser* info)
+{
+	return userlist.value (info);
 }
 
 // ============================================================================
@@ -151,7 +287,7 @@ QString IRCChannel::getStatusName (FStatusFlags mode)
 
 // ============================================================================
 //
-FStatusFlags IRCChannel::getStatusFlag (char c)
+static FStatusFlags knownStatusFlag (char c)
 {
 	switch (c)
 	{
@@ -167,49 +303,124 @@ FStatusFlags IRCChannel::getStatusFlag (char c)
 
 // ============================================================================
 //
-void IRCChannel::applyModeString (QString text)
+// Returns the status flag of status mode @c. The PREFIX token of the server
+// lists status modes from highest to lowest, so a mode we don't know, like
+// "Y" in "(Yqaohv)", gets the status of the nearest known mode below it, or
+// above it if it is the lowest.
+//
+FStatusFlags IRCChannel::getStatusFlag (char c) const
 {
-	if (text.isEmpty())
-		return;
+	const FStatusFlags flag = knownStatusFlag (c);
+	const QList<PrefixInfo>& prefixes = connection->prefixes;
+	int pos = 0;
+
+	if (flag != 0)
+		return flag;
 
-	bool	neg = false;
-	QString	modestring = text.split (" ", QString::SkipEmptyParts) [0];
-	bool	needNames = false;
+	while (pos < prefixes.size() && prefixes[pos].modesym != c)
+		pos++;
 
-	for (char c : modestring.toUtf8())
+	if (pos == prefixes.size())
+		return 0;
+
+	for (int i = pos + 1; i < prefixes.size(); ++i)
 	{
-		if (c == '+')
-		{
-			// +abc
-			neg = false;
-			continue;
-		}
+		if (knownStatusFlag (prefixes[i].modesym) != 0)
+			return knownStatusFlag (prefixes[i].modesym);
+	}
+
+	for (int i = pos - 1; i >= 0; --i)
+	{
+		if (knownStatusFlag (prefixes[i].modesym) != 0)
+			return knownStatusFlag (prefixes[i].modesym);
+	}
+
+	return FVoiced;
+}
 
-		if (c == '-')
+// ============================================================================
+//
+// Applies a mode change to this channel. @args holds the arguments following
+// @modestring. Each mode consumes arguments according to its type as told by
+// the PREFIX and CHANMODES tokens of the server, and status modes are applied
+// to the affected members directly.
+//
+void IRCChannel::applyModeString (const QString& modestring, const QStringList& args)
+{
+	bool			neg = false;
+	int				argIndex = 0;
+	UserlistDelta	delta;
+
+	for (int i = 0; i < modestring.length(); ++i)
+	{
+		const char c = modestring[i].toAscii();
+
+		if (c == '+' || c == '-')
 		{
-			// -abc
-			neg = true;
+			// +abc or -abc
+			neg = (c == '-');
 			continue;
 		}
 
-		// Handle status modes. Who on earth thought it was a good
-		// idea to have them as channel modes?
-		// Since we cannot really parse the mode string fully, we
-		// must ask the server for a new NAMES list.
-		if (c == 'o' || c == 'v' || c == 'h' || c == 'a' || c == 'q')
+		const ChannelModeType type = connection->getChannelModeType (c);
+
+		switch (type)
 		{
-			needNames = true;
-			continue;
-		}
+			case ChannelMode_Status:
+			{
+				if (argIndex >= args.size())
+					break;
+
+				UserlistEntry* e = findUserByName (args[argIndex++]);
+				FStatusFlags flag = getStatusFlag (c);
+
+				if (e == null || flag == 0)
+					break;
+
+				if (neg)
+					e->status &= ~flag;
+				else
+					e->status |= flag;
+
+				if (delta.changed.contains (e->userInfo) == false)
+					delta.changed << e->userInfo;
+			} break;
 
-		if (neg == false)
-			modes << c;
-		else
-			modes.removeOne (c);
+			case ChannelMode_List:
+			{
+				// Bans and such, we don't track these here.
+				argIndex++;
+			} break;
+
+			case ChannelMode_Parameter:
+			case ChannelMode_ParameterWhenSet:
+			case ChannelMode_Flag:
+			{
+				const bool hasArgument = (type == ChannelMode_Parameter) ||
+					(type == ChannelMode_ParameterWhenSet && neg == false);
+
+				if (neg == false)
+				{
+					if (modes.contains (c) == false)
+						modes << c;
+
+					if (hasArgument && argIndex < args.size())
+						modeArguments[c] = args[argIndex];
+				}
+				else
+				{
+					modes.removeOne (c);
+					modeArguments.remove (c);
+				}
+
+				if (hasArgument)
+					argIndex++;
+			} break;
+		}
 	}
 
-	if (needNames)
-		connection->write (format("NAMES :%1\n", name));
+	if (delta.isEmpty() == false)
+		announce (delta);
 }
 
 // ============================================================================
@@ -220,8 +431,13 @@ QString IRCChannel::getModeString() const
 	QStringList args;
 
 	for (char mode : modes)
+	{
 		modestring += mode;
 
+		if (modeArguments.contains (mode))
+			args << modeArguments[mode];
+	}
+
 	args.push_front (modestring);
 	return args.join (" ");
 }
@@ -230,87 +446,81 @@ QString IRCChannel::getModeString() const
 //
 void IRCChannel::addNames (const QStringList& names)
 {
-	static const struct
-	{
-		char	symbol;
-		EStatus	flag;
-	} statusflags[] =
-	{
-		{ '~',	FOwner	},
-		{ '&',	FAdmin	},
-		{ '@',	FOp		},
-		{ '%',	FHalfOp	},
-		{ '+',	FVoiced	},
-	};
-
 	for (QString nick : names)
 	{
 		FStatusFlags	flags = 0;
-		IRCUser*		user = connection->findUser (nick, true);
-		bool			repeat;
+		int				numPrefixes = 0;
+		char			modesym;
 
-		do
+		// Names are prefixed by the symbols of their status modes. There can be
+		// more than one with multi-prefix.
+		while (numPrefixes < nick.length() &&
+			(modesym = connection->getPrefixMode (nick[numPrefixes].toAscii())) != '\0')
 		{
-			repeat = false;
-
-			for (const auto & flaginfo : statusflags)
-			{
-				if (nick.startsWith (flaginfo.symbol))
-				{
-					nick.remove (0, 1);
-					flags |= flaginfo.flag;
-					repeat = true;
-					break;
-				}
-			}
+			flags |= getStatusFlag (modesym);
+			numPrefixes++;
 		}
-		while (repeat == true);
 
-		newNames << UserlistEntry (user, flags);
+		nick.remove (0, numPrefixes);
+
+		// Stage the name. Users are only looked up once the list is complete.
+		PendingName& pending = newNames[connection->foldCase (nick)];
+		pending.nickname = nick;
+		pending.status = flags;
 	}
 }
 
 // ============================================================================
 //
+// The NAMES list is complete. Compares the staged names against the current
+// userlist in one pass over each and applies the difference.
+//
 void IRCChannel::namesDone()
 {
-	QList<IRCUser*> oldusers;
+	UserlistDelta delta;
 
-	// This gets a bit tricky, I don't want any users to be deleted just because
-	// this is their only known channel and they would be auto-pruned in the
-	// process. So we flag them so that they won't be pruned and perform the
-	// pruning manually once we're done.
-	for (UserlistEntry & e : userlist)
+	// Go through the current members. Those not listed have left, and those
+	// listed may have had their status changed. Whatever remains staged
+	// afterwards is new to us.
+	for (auto it = userlist.begin(); it != userlist.end();)
 	{
-		e.userInfo->flags |= IRCUser::FDoNotDelete;
-		oldusers << e.userInfo;
-		e.userInfo->dropKnownChannel (this);
-	}
+		UserlistEntry* e = it.value();
+		const QString key = connection->foldCase (e->userInfo->nickname);
+		auto pending = newNames.find (key);
 
-	userlist = newNames;
-
-	// Now check which users in oldusers are still in the userlist.
-	for (auto it = oldusers.begin(); it != oldusers.end(); ++it)
-	{
-		IRCUser* user = *it;
+		if (pending == newNames.end())
+		{
+			delta.removed << e->userInfo;
+			userlistByName.remove (key);
+			it = userlist.erase (it);
+			delete e;
+			continue;
+		}
 
-		for (UserlistEntry& e : userlist)
+		if (pending->status != e->status)
 		{
-			if (e.userInfo == user)
-			{
-				it = oldusers.erase (it) - 1;
-				break;
-			}
+			e->status = pending->status;
+			delta.changed << e->userInfo;
 		}
+
+		newNames.erase (pending);
+		++it;
 	}
 
-	// Now remove the do not delete flag and perform pruning.
-	for (IRCUser * user : oldusers)
+	for (const PendingName& pending : newNames)
 	{
-		user->flags &= ~IRCUser::FDoNotDelete;
-		user->checkForPruning();
+		IRCUser* user = connection->findUser (pending.nickname, true);
+		insertEntry (user, pending.status);
+		delta.added << user;
 	}
 
 	newNames.clear();
-	emit userlistChanged();
+
+	if (delta.isEmpty() == false)
+		announce (delta);
+
+	// Now that the change has been queued, let the users who left forget
+	// about this channel. This may prune them.
+	for (IRCUser* user : delta.removed)
+		user->dropKnownChannel (this);
 }
@@ -2,11 +2,13 @@
 #define SPEECHBUBBLE_CHANNEL_H
 
 #include <QTime>
+#include <QHash>
 #include "main.h"
 
 class Context;
 class IRCConnection;
 class IRCUser;
+class UserlistModel;
 
 // =============================================================================
 //
@@ -25,6 +27,9 @@ Q_DECLARE_OPERATORS_FOR_FLAGS (FStatusFlags)
 
 // =============================================================================
 //
+// A member of a channel. Entries are allocated individually by the channel so
+// pointers to them stay valid for as long as the user is on the channel.
+//
 class UserlistEntry
 {
 	PROPERTY (IRCUser* userInfo)
@@ -39,6 +44,37 @@ public:
 	bool operator== (const UserlistEntry& other) const;
 };
 
+// =============================================================================
+//
+// Describes a change to the userlist of a channel. Removals are delivered at
+// once, since the removed users may be pruned right afterwards, while additions
+// and changes are held back and merged. Removed users are only good for
+// identification.
+//
+struct UserlistDelta
+{
+	QList<IRCUser*>	added;
+	QList<IRCUser*>	removed;
+	QList<IRCUser*>	changed;
+
+	inline bool isEmpty() const
+	{
+		return added.isEmpty() && removed.isEmpty() && changed.isEmpty();
+	}
+
+	void merge (const UserlistDelta& other);
+};
+
+// =============================================================================
+//
+// A name listed in a NAMES reply which has not been applied to the userlist yet.
+//
+struct PendingName
+{
+	QString			nickname;
+	FStatusFlags	status;
+};
+
 // =========================================================================
 //
 class IRCChannel : public QObject
@@ -49,10 +85,16 @@ class IRCChannel : public QObject
 	PROPERTY (QTime joinTime)
 	PROPERTY (Context* context)
 	PROPERTY (IRCConnection* connection)
-	PROPERTY (QList<UserlistEntry> userlist)
+	PROPERTY (QHash<IRCUser*, UserlistEntry*> userlist)
+	PROPERTY (QHash<QString, UserlistEntry*> userlistByName)
 	PROPERTY (QList<char> modes)
-	PROPERTY (QList<UserlistEntry> newNames)
+	PROPERTY (QMap<char, QString> modeArguments)
+	PROPERTY (QHash<QString, PendingName> newNames)
 	PROPERTY (bool isDoneWithNames);
+	PROPERTY (UserlistModel* userlistModel)
+	PROPERTY (int userlistBatchDepth)
+	PROPERTY (UserlistDelta pendingDelta)
+	PROPERTY (bool isUserlistFlushScheduled)
 	CLASSDATA (IRCChannel)
 
 public:
@@ -61,21 +103,32 @@ public:
 
 	UserlistEntry*			addUser (IRCUser* info);
 	void					addNames (const QStringList& names);
-	void					applyModeString (QString text);
-	UserlistEntry*			findUserByName (QString name);
+	void					applyModeString (const QString& modestring, const QStringList& args);
+	void					beginUserlistBatch();
+	void					endUserlistBatch();
+	UserlistEntry*			findUserByName (const QString& name);
 	UserlistEntry*			findUser (IRCUser* info);
 	QString					getModeString() const;
 	FStatusFlags			getStatusOf (IRCUser* info);
 	EStatus					getEffectiveStatusOf (IRCUser* info);
+	FStatusFlags			getStatusFlag (char c) const;
 	void					namesDone();
+	void					rebuildNameIndex();
 	void					removeUser (IRCUser* info);
+	void					userRenamed (IRCUser* info, const QString& oldnick);
 
 	static EStatus			effectiveStatus (FStatusFlags mode);
-	static FStatusFlags		getStatusFlag (char c);
 	static QString			getStatusName (FStatusFlags mode);
 
 signals:
-	void userlistChanged();
+	void userlistChanged (const UserlistDelta& delta);
+
+private slots:
+	void flushUserlistChanges();
+
+private:
+	void					announce (const UserlistDelta& delta);
+	UserlistEntry*			insertEntry (IRCUser* info, FStatusFlags status);
 };
 
 #endif // SPEECHBUBBLE_CHANNEL_H
@@ -1,7 +1,12 @@
+#include <QDateTime>
+#include <QElapsedTimer>
 #include "commands.h"
 #include "context.h"
 #include "connection.h"
+#include "logsegment.h"
+#include "logwriter.h"
 #include "misc.h"
+#include "searchindex.h"
 #include "user.h"
 
 #define COMMAND_FUNCTION_NAME(N) CommandDefinition_##N
@@ -64,7 +69,7 @@ static QString currentTarget()
 //
 static inline void writeRaw (QString text)
 {
-	getCurrentConnection()->write (text);
+	getCurrentConnection()->write (text, SendPriority_High);
 }
 
 // ============================================================================
@@ -135,6 +140,66 @@ DEFINE_COMMAND (ctcp)
 	Context::currentContext()->print (format ("\\c2[CTCP] %1 => %2", args[1], args[0]));
 }
 
+// ============================================================================
+//
+// Searches the logs for lines with all of the given words, newest first.
+// "nick:<nick>" only finds lines said by that nick and "in:<name>" only those
+// in channels or queries of that name.
+//
+DEFINE_COMMAND (search)
+{
+	CHECK_PARMS (1, -1, "[nick:<nick>] [in:<channel>] <words>")
+	SearchIndex* const index = LogWriter::searchIndex();
+	QStringList terms;
+	QString channel;
+
+	if (index == null)
+		error ("logging is disabled");
+
+	for (const QString& arg : args)
+	{
+		if (arg.startsWith ("nick:", Qt::CaseInsensitive))
+			terms << SearchIndex::nickTerm (arg.mid (5));
+		elif (arg.startsWith ("in:", Qt::CaseInsensitive))
+			channel = Context::logNameOf (getCurrentConnection(), arg.mid (3));
+		else
+			terms << SearchIndex::termsOf (arg);
+	}
+
+	if (terms.isEmpty())
+		error ("nothing to search for");
+
+	QElapsedTimer timer;
+	timer.start();
+	const QList<SearchHit> hits = index->search (terms, channel, 50);
+	const qint64 elapsed = timer.elapsed();
+	Context* const context = Context::currentContext();
+	LogSegmentReader reader;
+	QString readerPath;
+
+	// Newest last, like the rest of the output.
+	for (int i = hits.size() - 1; i >= 0; --i)
+	{
+		const SearchHit& hit = hits[i];
+		const QString path = LogSegmentWriter::findSegment (
+			LogWriter::logDirectory (hit.logName), hit.segmentStart);
+		qint64 time;
+		QByteArray text;
+
+		if (path != readerPath)
+			readerPath = reader.open (path) ? path : QString();
+
+		if (readerPath.isEmpty() || reader.readRecord (hit.offset, time, text) == -1)
+			continue;
+
+		const QString date = (time != 0)
+			? QDateTime::fromMSecsSinceEpoch (time).toString ("yyyy-MM-dd hh:mm ") : "";
+		context->printNote (format ("\\c02%1%2: ", date, hit.logName), QString::fromUtf8 (text));
+	}
+
+	context->printNote (format ("\\c02%1 lines found in %2 ms", hits.size(), int (elapsed)), "");
+}
+
 // ============================================================================
 //
 // Command aliases
@@ -156,6 +221,7 @@ const CommandInfo g_Commands[] =
 	DECLARE_COMMAND (raw)
 	DECLARE_COMMAND (me)
 	DECLARE_COMMAND (ctcp)
+	DECLARE_COMMAND (search)
 };
 
 // ============================================================================
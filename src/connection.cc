@@ -11,8 +11,10 @@
 #include "user.h"
 
 CONFIG (String, quitmessage, "Bye!")
-static QList<IRCConnection*> g_allConnections;
-static const QRegExp g_userMask ("^:([^\\!]+)\\!([^@]+)@(.+)$");
+CONFIG (Int, netsplit_delay, 1000)	// msec to wait for more quits or joins of a netsplit
+static QList<IRCConnection*>	g_allConnections;
+static IRCMessageHandler		g_commandHandlers[Command_NumCommands];
+static IRCMessageHandler		g_numericHandlers[1000];
 
 // =============================================================================
 //
@@ -21,13 +23,36 @@ IRCConnection::IRCConnection (QString host, quint16 port, QObject* parent) :
 	hostname (host),
 	port (port),
 	state (CNS_Disconnected),
+	caseMapping (CaseMapping_RFC1459),
 	ourselves (null),
 	socket (new QTcpSocket (this)),
-	timer (new QTimer)
+	timer (new QTimer),
+	sendTimer (new QTimer (this)),
+	bytesSent (0),
+	bytesReceived (0),
+	sendRate (0),
+	receiveRate (0),
+	rateTime (0),
+	rateBytesSent (0),
+	rateBytesReceived (0),
+	netsplitTimer (new QTimer (this)),
+	splitPurgeTime (0)
 {
+	initDispatchTables();
+
+	// Assume the common status modes and the RFC 2811 channel modes until the
+	// server tells us otherwise.
+	setPrefixes ("(qaohv)~&@%+");
+	channelModes << "beI" << "k" << "l" << "imnpst";
+
 	context = new Context (this);
 	win->addContext (context);
+	clock.start();
+	sendTimer->setSingleShot (true);
+	netsplitTimer->setSingleShot (true);
 	connect (timer, SIGNAL (timeout()), this, SLOT (tick()));
+	connect (sendTimer, SIGNAL (timeout()), this, SLOT (flushSendQueue()));
+	connect (netsplitTimer, SIGNAL (timeout()), this, SLOT (finishHeuristicBatches()));
 	connect (socket, SIGNAL (readyRead()), this, SLOT (readyRead()));
 	g_allConnections << this;
 }
@@ -41,22 +66,87 @@ IRCConnection::~IRCConnection()
 
 // =============================================================================
 //
-void IRCConnection::tick() {}
+// Updates the traffic rate counters once per second.
+//
+void IRCConnection::tick()
+{
+	const qint64 now = clock.elapsed();
+	const qint64 elapsed = now - rateTime;
+
+	if (elapsed >= 1000)
+	{
+		sendRate = ((bytesSent - rateBytesSent) * 1000) / elapsed;
+		receiveRate = ((bytesReceived - rateBytesReceived) * 1000) / elapsed;
+		rateTime = now;
+		rateBytesSent = bytesSent;
+		rateBytesReceived = bytesReceived;
+	}
+
+	// Once a minute, forget users lost in netsplits which never came back.
+	if (splitUsers.isEmpty() == false && now - splitPurgeTime >= 60000)
+	{
+		splitPurgeTime = now;
+
+		for (auto it = splitUsers.begin(); it != splitUsers.end();)
+		{
+			if (now - it->time >= 600000)
+				it = splitUsers.erase (it);
+			else
+				++it;
+		}
+	}
+}
 
 // =============================================================================
 //
-void IRCConnection::write (QString text)
+// Queues @text to be sent to the server. Everything written during one event
+// loop turn goes out in a single socket write, subject to flood control.
+//
+void IRCConnection::write (QString text, SendPriority priority)
 {
-	socket->write (text.toUtf8());
-	::print ("<- %1", text);
+	dprint ("<- %1", text);
+	sendQueue.enqueue (text.toUtf8(), priority);
+
+	if (sendTimer->isActive() == false)
+		sendTimer->start (0);
+}
+
+// =============================================================================
+//
+void IRCConnection::flushSendQueue() // [slot]
+{
+	QByteArray data;
+	const qint64 wait = sendQueue.takeAllowed (data, clock.elapsed());
+
+	if (data.isEmpty() == false)
+	{
+		socket->write (data);
+		bytesSent += data.size();
+	}
+
+	// If flood control held something back, come back when it can be sent.
+	if (wait > 0)
+		sendTimer->start (wait);
+}
+
+// =============================================================================
+//
+int IRCConnection::sendQueueDepth() const
+{
+	return sendQueue.depth();
 }
 
 // =============================================================================
 //
 void IRCConnection::writeLogin()
 {
+	// Ask for batches so that netsplits are announced as such. Servers which
+	// don't know of capabilities reply with an unknown command error, which
+	// is harmless.
+	write ("CAP REQ :batch\n");
 	write (format ("USER %1 * * :%2\n", username, realname));
 	write (format ("NICK %1\n", nickname));
+	write ("CAP END\n");
 	state = ERegistering;
 	print (format (tr ("Registering as \\b%1:%2:%3..."), nickname, username, realname));
 	disconnect (socket, SIGNAL (connected()));
@@ -66,6 +156,7 @@ void IRCConnection::writeLogin()
 //
 void IRCConnection::connectToServer()
 {
+	receiveBuffer.clear();
 	socket->connectToHost (hostname, port);
 	timer->start (100);
 	state = EConnecting;
@@ -82,9 +173,22 @@ void IRCConnection::disconnectFromServer (QString quitmessage)
 	if (quitmessage.isEmpty())
 		quitmessage = cfg::quitmessage;
 
+	// Anything still queued is dropped. The QUIT goes out right away so that
+	// flood control doesn't hold it back.
+	sendQueue.clear();
+	sendTimer->stop();
+
 	if (state == EConnected)
-		write (format ("QUIT :%1\n", quitmessage));
+	{
+		QByteArray quit = format ("QUIT :%1\n", quitmessage).toUtf8();
+		socket->write (quit);
+		bytesSent += quit.size();
+	}
 
+	for (const QString& id : netsplitBatches.keys())
+		finishBatch (id);
+
+	splitUsers.clear();
 	socket->disconnectFromHost();
 	timer->stop();
 	state = CNS_Disconnected;
@@ -101,17 +205,43 @@ void IRCConnection::print (QString msg)
 //
 void IRCConnection::readyRead() // [slot]
 {
-	QString data = lineWork + QString (socket->readAll());
-	data.replace ("\r", "");
-	QStringList datalist = data.split ("\n");
+	qint64 available;
 
-	for (auto it = datalist.begin(); it < datalist.end() - 1; ++it)
-		processMessage (*it);
+	while ((available = socket->bytesAvailable()) > 0)
+	{
+		int space;
+		char* dest = receiveBuffer.prepareWrite (qMin<qint64> (available, 65536), space);
+		qint64 bytes = socket->read (dest, space);
 
-	if (datalist.size() > 1)
-		lineWork = datalist.last();
-	else
-		lineWork += data;
+		if (bytes <= 0)
+			break;
+
+		receiveBuffer.commitWrite (bytes);
+		bytesReceived += bytes;
+		const char* line;
+		int length;
+
+		while (receiveBuffer.nextLine (line, length))
+			processLine (line, length);
+	}
+}
+
+// =============================================================================
+//
+// Processes a single line received from the server. @data points into the
+// receive buffer and is only valid for the duration of this call.
+//
+void IRCConnection::processLine (const char* data, int length)
+{
+	if (length == 0)
+		return;
+
+	IRCMessage msg;
+
+	if (msg.parse (QString::fromUtf8 (data, length)) == false)
+		return;
+
+	processMessage (msg);
 }
 
 // =============================================================================
@@ -126,62 +256,88 @@ void IRCConnection::processConnectionError (QAbstractSocket::SocketError err) //
 
 // =============================================================================
 //
-void IRCConnection::processMessage (QString msg)
+// Fills in the dispatch tables. Named commands are indexed by their interned
+// command ID and numeric replies by the reply code itself, so dispatching a line
+// is a single array lookup regardless of how many handlers there are.
+//
+void IRCConnection::initDispatchTables() // [static]
 {
-	::print ("-> %1\n", msg);
-	QStringList tokens = msg.split (" ", QString::SkipEmptyParts);
+	static bool initialized = false;
 
-	if (tokens.size() < 2)
+	if (initialized)
 		return;
 
-	if (tokens.size() > 1 && tokens[0] == "PING")
-	{
-		write ("PONG " + subset (tokens, 1) + "\n");
-		return;
-	}
+	initialized = true;
+	g_commandHandlers[Command_Batch]			= &IRCConnection::processBatch;
+	g_commandHandlers[Command_Join]				= &IRCConnection::processJoin;
+	g_commandHandlers[Command_Mode]				= &IRCConnection::processMode;
+	g_commandHandlers[Command_Nick]				= &IRCConnection::processNick;
+	g_commandHandlers[Command_Part]				= &IRCConnection::processPart;
+	g_commandHandlers[Command_Ping]				= &IRCConnection::processPing;
+	g_commandHandlers[Command_Privmsg]			= &IRCConnection::processPrivmsg;
+	g_commandHandlers[Command_Quit]				= &IRCConnection::processQuit;
+	g_commandHandlers[Command_Topic]			= &IRCConnection::processTopicChange;
+
+	g_numericHandlers[Reply_Welcome]			= &IRCConnection::processWelcome;
+	g_numericHandlers[Reply_YourHost]			= &IRCConnection::processServerText;
+	g_numericHandlers[Reply_Created]			= &IRCConnection::processServerText;
+	g_numericHandlers[Reply_Supported]			= &IRCConnection::processSupported;
+	g_numericHandlers[Reply_MotdStart]			= &IRCConnection::processServerText;
+	g_numericHandlers[Reply_Motd]				= &IRCConnection::processServerText;
+	g_numericHandlers[Reply_EndOfMotd]			= &IRCConnection::processServerText;
+	g_numericHandlers[Reply_ChannelModeIs]		= &IRCConnection::processChannelModeIs;
+	g_numericHandlers[Reply_NameReply]			= &IRCConnection::processNameReply;
+	g_numericHandlers[Reply_EndOfNames]			= &IRCConnection::processEndOfNames;
+	g_numericHandlers[Reply_Topic]				= &IRCConnection::processTopicReply;
+	g_numericHandlers[Reply_TopicSetAt]			= &IRCConnection::processTopicSetAt;
+}
 
-	bool ok;
-	int num = tokens[1].toInt (&ok);
+// =============================================================================
+//
+void IRCConnection::processMessage (const IRCMessage& msg)
+{
+	dprint ("-> %1\n", msg.raw());
+	IRCMessageHandler handler;
 
-	if (ok == true)
-	{
-		parseNumeric (msg, tokens, num);
-		return;
-	}
+	if (msg.isNumeric())
+		handler = g_numericHandlers[msg.numeric()];
+	else
+		handler = g_commandHandlers[msg.commandId()];
+
+	if (handler != null)
+		(this->*handler) (msg);
+}
 
-	if (tokens[1] == "JOIN")
-		processJoin (msg, tokens);
-	elif (tokens[1] == "PART")
-		processPart (msg, tokens);
-	elif (tokens[1] == "QUIT")
-		processQuit (msg, tokens);
-	elif (tokens[1] == "PRIVMSG")
-		processPrivmsg (msg, tokens);
-	elif (tokens[1] == "MODE")
-		processMode (msg, tokens);
-	elif (tokens[1] == "TOPIC")
-		processTopicChange (msg, tokens);
+// =============================================================================
+//
+// Replies to a PING with its token. A PING without one is answered with the
+// name of the server, as an empty PONG is rejected by some servers.
+//
+void IRCConnection::processPing (const IRCMessage& msg)
+{
+	if (msg.paramCount() == 0)
+		write (format ("PONG :%1\n", hostname), SendPriority_High);
+	else
+		write (format ("PONG :%1\n", msg.lastParam()), SendPriority_High);
 }
 
 // =============================================================================
 //
-void IRCConnection::processJoin (QString msg, QStringList tokens)
+void IRCConnection::processJoin (const IRCMessage& msg)
 {
-	if (tokens.size() != 3 || g_userMask.indexIn (tokens[0]) == -1)
+	if (msg.paramCount() < 1 || msg.hasUserPrefix() == false)
 	{
-		warning (format ("Recieved illegible JOIN from server: %1", msg));
+		warning (format ("Recieved illegible JOIN from server: %1", msg.raw()));
 		return;
 	}
 
-	QString channame = tokens[2];
-	QString joiner = g_userMask.capturedTexts() [1];
-
-	if (Q_LIKELY (channame.startsWith (":")))
-		channame.remove (0, 1);
+	QString channame = msg.param (0).toString();
+	QString joiner = msg.nick().toString();
+	const bool isOurJoin = (foldCase (joiner) == foldCase (ourselves->nickname));
 
 	// Find the channel by name. Create it if we join it, but not if someone joins a
 	// channel we know nothing about.
-	IRCChannel* chan = findChannel (channame, joiner == ourselves->nickname);
+	IRCChannel* chan = findChannel (channame, isOurJoin);
 
 	if (chan == null)
 	{
@@ -192,7 +348,8 @@ void IRCConnection::processJoin (QString msg, QStringList tokens)
 	// Find a data field for the newcomer. They can be totally new to us so we
 	// can create a data field for them if we don't already have one.
 	IRCUser* user = findUser (joiner, true);
-	assert (joiner != ourselves->nickname || user == ourselves);
+	assert (isOurJoin == false || user == ourselves);
+	user->updateUserHost (msg.user(), msg.host());
 
 	if (chan->findUser (user) != null)
 	{
@@ -200,6 +357,24 @@ void IRCConnection::processJoin (QString msg, QStringList tokens)
 		return;
 	}
 
+	// Users coming back from a netsplit are announced together.
+	NetsplitBatch* batch = batchOf (msg);
+
+	if (batch == null && user != ourselves)
+	{
+		auto split = splitUsers.find (foldCase (joiner));
+
+		if (split != splitUsers.end())
+			batch = heuristicBatch (split->servers, true);
+	}
+
+	if (batch != null)
+	{
+		addToBatch (*batch, chan, user->nickname);
+		chan->addUser (user);
+		return;
+	}
+
 	chan->addUser (user);
 	QString msgToPrint;
 
@@ -213,21 +388,58 @@ void IRCConnection::processJoin (QString msg, QStringList tokens)
 
 // =============================================================================
 //
-void IRCConnection::processPart (QString msg, QStringList tokens)
+void IRCConnection::processNick (const IRCMessage& msg)
 {
-	if (tokens.size() < 3 || g_userMask.indexIn (tokens[0]) == -1)
+	if (msg.paramCount() < 1 || msg.hasUserPrefix() == false)
 	{
-		warning (format ("Recieved illegible PART from server: %1", msg));
+		warning (format (tr ("Recieved illegible NICK from server: %1"), msg.raw()));
 		return;
 	}
 
-	QString partmsg;
-	QString parter = g_userMask.capturedTexts()[1];
-	QString channame = tokens[2];
+	QString oldnick = msg.nick().toString();
+	QString newnick = msg.param (0).toString();
+	IRCUser* user = findUser (oldnick, false);
 
-	if (channame.startsWith (":"))
-		channame.remove (0, 1);
+	if (user == null)
+	{
+		warning (format (tr ("Recieved strange NICK from server: apparently some "
+			"\"%1\" is now known as \"%2\"?"), oldnick, newnick));
+		return;
+	}
+
+	renameUser (user, newnick);
+	user->updateUserHost (msg.user(), msg.host());
+	QString text = format (tr ("* %1 is now known as %2"), oldnick, newnick);
+
+	if (user == ourselves)
+	{
+		nickname = newnick;
+		print (text);
+	}
 
+	for (IRCChannel* chan : user->channels)
+		chan->context->print (text);
+
+	if (user->context != null)
+	{
+		user->context->print (text);
+		user->context->updateTreeItem();
+	}
+}
+
+// =============================================================================
+//
+void IRCConnection::processPart (const IRCMessage& msg)
+{
+	if (msg.paramCount() < 1 || msg.hasUserPrefix() == false)
+	{
+		warning (format ("Recieved illegible PART from server: %1", msg.raw()));
+		return;
+	}
+
+	QString parter = msg.nick().toString();
+	QString channame = msg.param (0).toString();
+	QString partmsg = msg.param (1).toString();
 	IRCUser* user = findUser (parter, false);
 	IRCChannel* chan = findChannel (channame, false);
 
@@ -238,14 +450,8 @@ void IRCConnection::processPart (QString msg, QStringList tokens)
 		return;
 	}
 
-	if (tokens.size() >= 4)
-	{
-		partmsg = subset (tokens, 3);
-
-		if (Q_LIKELY (partmsg.startsWith (":")))
-			partmsg.remove (0, 1);
-	}
-
+	// Do this before removing the user, it may prune them.
+	user->updateUserHost (msg.user(), msg.host());
 	chan->removeUser (user);
 
 	// If we left the channel, drop it now
@@ -258,16 +464,44 @@ void IRCConnection::processPart (QString msg, QStringList tokens)
 
 // =============================================================================
 //
-void IRCConnection::processQuit (QString msg, QStringList tokens)
+// The classic netsplit quit message consists of the names of the two servers
+// which lost each other, e.g. "irc.example.net hub.example.net". Quit messages
+// of users can't look like this since servers prefix them with "Quit: ".
+//
+static bool isNetsplitMessage (const QString& message)
+{
+	const QStringList servers = message.split (" ");
+
+	if (servers.size() != 2 || servers[0] == servers[1])
+		return false;
+
+	for (const QString& server : servers)
+	{
+		if (server.contains (".") == false || server.startsWith (".") || server.endsWith ("."))
+			return false;
+
+		for (const QChar& c : server)
+		{
+			if (c.isLetterOrNumber() == false && c != '.' && c != '-' && c != '_' && c != '*')
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// =============================================================================
+//
+void IRCConnection::processQuit (const IRCMessage& msg)
 {
-	if (tokens.size() < 2 || g_userMask.indexIn (tokens[0]) == -1)
+	if (msg.hasUserPrefix() == false)
 	{
-		warning (format (tr ("Recieved illegible QUIT from server: %1"), msg));
+		warning (format (tr ("Recieved illegible QUIT from server: %1"), msg.raw()));
 		return;
 	}
 
-	QString quitter = g_userMask.capturedTexts() [1];
-	QString quitmessage;
+	QString quitter = msg.nick().toString();
+	QString quitmessage = msg.param (0).toString();
 	IRCUser* user = findUser (quitter, false);
 
 	if (!user)
@@ -277,12 +511,29 @@ void IRCConnection::processQuit (QString msg, QStringList tokens)
 		return;
 	}
 
-	if (tokens.size() >= 3)
+	user->updateUserHost (msg.user(), msg.host());
+
+	// Users lost in a netsplit are announced together.
+	NetsplitBatch* batch = batchOf (msg);
+
+	if (batch == null && isNetsplitMessage (quitmessage))
+		batch = heuristicBatch (quitmessage, false);
+
+	if (batch != null)
 	{
-		quitmessage = subset (tokens, 2);
+		for (IRCChannel* chan : user->channels)
+			addToBatch (*batch, chan, quitter);
 
-		if (Q_LIKELY (quitmessage.startsWith (":")))
-			quitmessage.remove (0, 1);
+		if (batch->isHeuristic)
+		{
+			SplitUser split;
+			split.servers = batch->servers;
+			split.time = clock.elapsed();
+			splitUsers.insert (foldCase (quitter), split);
+		}
+
+		delete user;
+		return;
 	}
 
 	// Announce the quit in all channels he's in
@@ -295,25 +546,23 @@ void IRCConnection::processQuit (QString msg, QStringList tokens)
 
 // =============================================================================
 //
-void IRCConnection::processPrivmsg (QString msg, QStringList tokens)
+void IRCConnection::processPrivmsg (const IRCMessage& msg)
 {
-	if (tokens.size() < 4 || g_userMask.indexIn (tokens[0]) == -1)
+	if (msg.paramCount() < 2 || msg.hasUserPrefix() == false)
 	{
-		warning (format (tr ("Recieved illegible PRIVMSG from server: %1"), msg));
+		warning (format (tr ("Recieved illegible PRIVMSG from server: %1"), msg.raw()));
 		return;
 	}
 
-	QString usernick = g_userMask.capturedTexts()[1];
+	QString usernick = msg.nick().toString();
 	IRCUser* user = findUser (usernick, false);
 	Context* ctx = null;
-	QString message = subset (tokens, 3);
-
-	if (Q_LIKELY (message.startsWith (":")))
-		message.remove (0, 1);
+	const QStringRef target = msg.param (0);
+	QString message = msg.param (1).toString();
 
-	if (tokens[2][0] == '#')
+	if (target.at (0) == '#')
 	{
-		IRCChannel* chan = findChannel (tokens[2], false);
+		IRCChannel* chan = findChannel (target.toString(), false);
 
 		if (chan != null)
 			ctx = chan->context;
@@ -332,7 +581,7 @@ void IRCConnection::processPrivmsg (QString msg, QStringList tokens)
 		if ((ctx = Context::currentContext())->getConnection() != this)
 			ctx = context;
 	}
-	elif (tokens[2] == ourselves->nickname)
+	elif (foldCase (target) == foldCase (ourselves->nickname))
 	{
 		// If the target field is our name, then this is a PM coming to us.
 		// Ensure we have a data field for this person now
@@ -349,10 +598,13 @@ void IRCConnection::processPrivmsg (QString msg, QStringList tokens)
 	else
 	{
 		warning (format (tr ("Recieved strange PRIVMSG from %1 to \"%2\": %3"),
-			usernick, tokens[2], msg));
+			usernick, target, msg.raw()));
 		return;
 	}
 
+	if (user != null)
+		user->updateUserHost (msg.user(), msg.host());
+
 	// Handle CTCP here
 	if (message.startsWith ("\001"))
 	{
@@ -371,17 +623,17 @@ void IRCConnection::processPrivmsg (QString msg, QStringList tokens)
 			if (ctcpcmd == "version")
 			{
 				write (format ("NOTICE %1 :\001VERSION " APPNAME " %2\001\n",
-					usernick, getVersionString()));
+					usernick, getVersionString()), SendPriority_Bulk);
 			}
 			elif (ctcpcmd == "time")
 			{
 				write (format ("NOTICE %1 :\001TIME %2\001\n",
-					usernick, QDateTime::currentDateTime().toString (Qt::TextDate)));
+					usernick, QDateTime::currentDateTime().toString (Qt::TextDate)), SendPriority_Bulk);
 			}
 			elif (ctcpcmd == "ping")
 			{
 				write (format ("NOTICE %1 :\001PING %2\001\n",
-					usernick, message.mid (strlen ("PING "))));
+					usernick, message.mid (strlen ("PING "))), SendPriority_Bulk);
 			}
 			elif (ctcpcmd == "action")
 			{
@@ -403,61 +655,59 @@ void IRCConnection::processPrivmsg (QString msg, QStringList tokens)
 
 // =============================================================================
 //
-void IRCConnection::processMode (QString msg, QStringList tokens)
+void IRCConnection::processMode (const IRCMessage& msg)
 {
-	if (tokens.size() < 4 || g_userMask.indexIn (tokens[0]) == -1)
+	if (msg.paramCount() < 2)
 	{
-		warning (format (tr ("Recieved illegible MODE from server: %1"), msg));
+		warning (format (tr ("Recieved illegible MODE from server: %1"), msg.raw()));
 		return;
 	}
 
-	QString usernick = g_userMask.capturedTexts()[1];
-	QString modestring = subset (tokens, 3, -1);
-	IRCChannel* chan = findChannel (tokens[2], false);
+	// Servers set modes too, in which case nick() is the server name.
+	QString setter = msg.nick().toString();
+	QString modestring = msg.paramsFrom (1);
+	IRCChannel* chan = findChannel (msg.param (0).toString(), false);
 
 	if (chan == null)
 	{
-		warning (format (tr ("Recieved strange MODE from server: %1"), subset (tokens, 2, -1)));
+		warning (format (tr ("Recieved strange MODE from server: %1"), msg.paramsFrom (0)));
 		return;
 	}
 
-	chan->applyModeString (modestring);
-	chan->context->print (format (tr ("* %1 has set mode %2"), usernick, modestring));
+	QStringList args;
+
+	for (int i = 2; i < msg.paramCount(); ++i)
+		args << msg.param (i).toString();
+
+	chan->applyModeString (msg.param (1).toString(), args);
+	chan->context->print (format (tr ("* %1 has set mode %2"), setter, modestring));
 }
 
 // =============================================================================
 //
-void IRCConnection::processTopicChange (QString msg, QStringList tokens)
+void IRCConnection::processTopicChange (const IRCMessage& msg)
 {
 	IRCChannel* chan;
 
-	if (tokens.size() < 4 || (chan = findChannel (tokens[2], false)) == null)
+	if (msg.paramCount() < 2 || (chan = findChannel (msg.param (0).toString(), false)) == null)
 	{
-		warning (format (tr ("Recieved illegible TOPIC from server: %1"), msg));
+		warning (format (tr ("Recieved illegible TOPIC from server: %1"), msg.raw()));
 		return;
 	}
 
-	QString newtopic = subset (tokens, 3, -1);
-
-	if (newtopic.startsWith (":"))
-		newtopic.remove (0, 1);
-
+	QString newtopic = msg.param (1).toString();
 	QString setterDescription;
 
-	if (g_userMask.indexIn (tokens[0]) != -1)
+	if (msg.hasUserPrefix())
 	{
-		setterDescription = format ("%1 (%2@%3)",
-			g_userMask.capturedTexts()[1],
-			g_userMask.capturedTexts()[2],
-			g_userMask.capturedTexts()[3]);
-	}
-	else
-	{
-		setterDescription = tokens[0];
+		setterDescription = format ("%1 (%2@%3)", msg.nick(), msg.user(), msg.host());
+		IRCUser* setter = findUser (msg.nick().toString(), false);
 
-		if (Q_LIKELY (setterDescription.startsWith (":")))
-			setterDescription.remove (0, 1);
+		if (setter != null)
+			setter->updateUserHost (msg.user(), msg.host());
 	}
+	else
+		setterDescription = msg.prefix().toString();
 
 	chan->topic = newtopic;
 	chan->context->print (format (tr ("* %1 has set the channel topic to: %2"), setterDescription, newtopic));
@@ -465,98 +715,153 @@ void IRCConnection::processTopicChange (QString msg, QStringList tokens)
 
 // =============================================================================
 //
-void IRCConnection::parseNumeric (QString msg, QStringList tokens, int num)
+void IRCConnection::processWelcome (const IRCMessage& msg)
 {
-	(void) msg;
+	state = EConnected;
+	print ("\\b\\c3Connected!");
 
-	switch (num)
+	if (ourselves == null)
 	{
-		case Reply_Welcome:
-			state = EConnected;
-			print ("\\b\\c3Connected!");
+		IRCUser* user = findUser (nickname, true);
+		user->username = username;
+		user->realname = realname;
+		ourselves = user;
+	}
 
-			if (ourselves == null)
-			{
-				IRCUser* user = findUser (nickname, true);
-				user->username = username;
-				user->realname = realname;
-				ourselves = user;
-			}
-		case Reply_YourHost:
-		case Reply_Created:
-		case Reply_MotdStart:
-		case Reply_Motd:
-		case Reply_EndOfMotd:
-		{
-			QString msg = subset (tokens, 3);
+	processServerText (msg);
+}
+
+// =============================================================================
+//
+// RPL_ISUPPORT: the server tells us about its features as KEY=VALUE tokens. The
+// first parameter is our nickname and the last one is a human-readable remark.
+//
+void IRCConnection::processSupported (const IRCMessage& msg)
+{
+	for (int i = 1; i < msg.paramCount() - 1; ++i)
+	{
+		QString token = msg.param (i).toString();
 
-			if (msg[0] == QChar (':'))
-				msg.remove (0, 1);
+		// A token in the form of -KEY negates a previously advertised one.
+		if (token.startsWith ("-"))
+		{
+			supported.remove (token.mid (1));
+			continue;
+		}
 
-			print (msg);
-		} break;
+		int eq = token.indexOf ('=');
+		QString key = (eq != -1) ? token.left (eq) : token;
+		QString value = (eq != -1) ? token.mid (eq + 1) : QString();
+		supported[key] = value;
 
-		case Reply_NameReply:
+		if (key == "CASEMAPPING")
 		{
-			IRCChannel* chan;
+			if (value == "ascii")
+				setCaseMapping (CaseMapping_Ascii);
+			elif (value == "strict-rfc1459")
+				setCaseMapping (CaseMapping_StrictRFC1459);
+			else
+				setCaseMapping (CaseMapping_RFC1459);
+		}
+		elif (key == "PREFIX")
+			setPrefixes (value);
+		elif (key == "CHANMODES")
+		{
+			channelModes = value.split (",");
 
-			if (tokens.size() < 6 || (chan = findChannel (tokens[4], false)) == null)
-				return;
+			while (channelModes.size() < 4)
+				channelModes << QString();
+		}
+	}
+}
 
-			QString namestring = subset (tokens, 5, -1);
+// =============================================================================
+//
+// RPL_CHANNELMODEIS: the current modes of a channel, usually as a response to
+// a MODE query when joining.
+//
+void IRCConnection::processChannelModeIs (const IRCMessage& msg)
+{
+	IRCChannel* chan;
 
-			if (Q_LIKELY (namestring.startsWith (":")))
-				namestring.remove (0, 1);
+	if (msg.paramCount() < 3 || (chan = findChannel (msg.param (1).toString(), false)) == null)
+		return;
 
-			chan->addNames (namestring.split (" "));
-		} break;
+	QStringList args;
 
-		case Reply_EndOfNames:
-		{
-			IRCChannel* chan;
+	for (int i = 3; i < msg.paramCount(); ++i)
+		args << msg.param (i).toString();
 
-			if (tokens.size() < 4 || (chan = findChannel (tokens[3], false)) == null)
-				return;
+	chan->applyModeString (msg.param (2).toString(), args);
+}
 
-			chan->namesDone();
-		} break;
+// =============================================================================
+//
+// Prints informational replies such as the MOTD to the server context.
+//
+void IRCConnection::processServerText (const IRCMessage& msg)
+{
+	print (msg.paramsFrom (1));
+}
 
-		case Reply_Topic:
-		{
-			IRCChannel* chan;
+// =============================================================================
+//
+void IRCConnection::processNameReply (const IRCMessage& msg)
+{
+	IRCChannel* chan;
 
-			if (tokens.size() < 4 || (chan = findChannel (tokens[3], false)) == null)
-				return;
+	if (msg.paramCount() < 4 || (chan = findChannel (msg.param (2).toString(), false)) == null)
+		return;
 
-			QString topic = subset (tokens, 4, -1);
+	chan->addNames (msg.param (3).toString().split (" ", QString::SkipEmptyParts));
+}
 
-			if (Q_LIKELY (topic.startsWith (":")))
-				topic.remove (0, 1);
+// =============================================================================
+//
+void IRCConnection::processEndOfNames (const IRCMessage& msg)
+{
+	IRCChannel* chan;
 
-			chan->topic = topic;
-			chan->context->print (format (tr ("* Channel topic is: %1"), topic));
-		} break;
+	if (msg.paramCount() < 2 || (chan = findChannel (msg.param (1).toString(), false)) == null)
+		return;
 
-		case Reply_TopicSetAt:
-		{
-			IRCChannel* chan;
+	chan->namesDone();
+}
 
-			if (tokens.size() != 6 || (chan = findChannel (tokens[3], false)) == null)
-				return;
+// =============================================================================
+//
+void IRCConnection::processTopicReply (const IRCMessage& msg)
+{
+	IRCChannel* chan;
 
-			bool ok;
-			int time = tokens[5].toLong (&ok);
+	if (msg.paramCount() < 3 || (chan = findChannel (msg.param (1).toString(), false)) == null)
+		return;
 
-			if (!ok)
-			{
-				warning (format (tr ("Bad timestamp for topic of %1, got: %2"), tokens[3], tokens[5]));
-				return;
-			}
+	QString topic = msg.param (2).toString();
+	chan->topic = topic;
+	chan->context->print (format (tr ("* Channel topic is: %1"), topic));
+}
+
+// =============================================================================
+//
+void IRCConnection::processTopicSetAt (const IRCMessage& msg)
+{
+	IRCChannel* chan;
+
+	if (msg.paramCount() != 4 || (chan = findChannel (msg.param (1).toString(), false)) == null)
+		return;
 
-			chan->context->print (format (tr ("* Topic was set by %1 on %2"), tokens[4],
-				QDateTime::fromTime_t (time).toString (Qt::TextDate)));
-		} break;
+	bool ok;
+	int time = msg.param (3).toString().toLong (&ok);
+
+	if (!ok)
+	{
+		warning (format (tr ("Bad timestamp for topic of %1, got: %2"), msg.param (1), msg.param (3)));
+		return;
 	}
+
+	chan->context->print (format (tr ("* Topic was set by %1 on %2"), msg.param (2),
+		QDateTime::fromTime_t (time).toString (Qt::TextDate)));
 }
 
 // =============================================================================
@@ -581,6 +886,9 @@ void IRCConnection::addChannel (IRCChannel* a)
 void IRCConnection::removeChannel (IRCChannel* a)
 {
 	channels.removeOne (a);
+
+	for (NetsplitBatch& batch : netsplitBatches)
+		batch.nicknames.remove (a);
 }
 
 // =============================================================================
@@ -610,26 +918,359 @@ void IRCConnection::warning (QString msg)
 
 // =============================================================================
 //
-IRCUser* IRCConnection::findUser (QString nickname, bool createIfNeeded)
+// Folds character @c to lowercase according to @mapping. Under rfc1459 rules
+// the characters []\~ are the uppercase forms of {}|^ respectively, strict
+// rfc1459 does not consider ~ and ^ to be related.
+//
+static inline ushort foldCharacter (ushort c, ECaseMapping mapping)
 {
-	for (IRCUser* user : users)
-		if (user->nickname == nickname)
-			return user;
+	if (c >= 'A' && c <= 'Z')
+		return c + ('a' - 'A');
 
-	if (createIfNeeded)
+	if (mapping == CaseMapping_Ascii)
+		return c;
+
+	switch (c)
+	{
+		case '[':	return '{';
+		case ']':	return '}';
+		case '\\':	return '|';
+		case '~':	return (mapping == CaseMapping_RFC1459) ? '^' : c;
+	}
+
+	return c;
+}
+
+// =============================================================================
+//
+// Returns @text case-folded with the casemapping of this network. The string is
+// only copied if it actually has characters to fold.
+//
+QString IRCConnection::foldCase (const QString& text) const
+{
+	QString result (text);
+	QChar* data = null;
+
+	for (int i = 0; i < text.length(); ++i)
+	{
+		const ushort c = text[i].unicode();
+		const ushort folded = foldCharacter (c, caseMapping);
+
+		if (folded != c)
+		{
+			if (data == null)
+				data = result.data();
+
+			data[i] = QChar (folded);
+		}
+	}
+
+	return result;
+}
+
+// =============================================================================
+//
+// Changes the casemapping of this network and rebuilds the nickname index
+// with the new rules.
+//
+void IRCConnection::setCaseMapping (ECaseMapping mapping)
+{
+	if (mapping == caseMapping)
+		return;
+
+	caseMapping = mapping;
+	QHash<QString, IRCUser*> oldusers = users;
+	users.clear();
+
+	for (IRCUser* user : oldusers)
+		users.insert (foldCase (user->nickname), user);
+
+	for (IRCChannel* chan : channels)
+		chan->rebuildNameIndex();
+}
+
+// =============================================================================
+//
+// Parses the value of the PREFIX token, e.g. "(ov)@+", into the list of status
+// modes and their nickname prefixes.
+//
+void IRCConnection::setPrefixes (const QString& token)
+{
+	int close = token.indexOf (')');
+
+	if (token.startsWith ("(") == false || close == -1)
+		return;
+
+	const QString modesyms = token.mid (1, close - 1);
+	const QString symbols = token.mid (close + 1);
+	prefixes.clear();
+
+	for (int i = 0; i < modesyms.length() && i < symbols.length(); ++i)
+	{
+		PrefixInfo info;
+		info.modesym = modesyms[i].toAscii();
+		info.prefix = symbols[i].toAscii();
+		prefixes << info;
+	}
+}
+
+// =============================================================================
+//
+// Returns the status mode which nickname prefix @prefix stands for, or '\0' if
+// @prefix is not a status prefix.
+//
+char IRCConnection::getPrefixMode (char prefix) const
+{
+	for (const PrefixInfo& info : prefixes)
+	{
+		if (info.prefix == prefix)
+			return info.modesym;
+	}
+
+	return '\0';
+}
+
+// =============================================================================
+//
+ChannelModeType IRCConnection::getChannelModeType (char mode) const
+{
+	static const ChannelModeType types[] =
 	{
-		IRCUser* user = new IRCUser (this);
+		ChannelMode_List,
+		ChannelMode_Parameter,
+		ChannelMode_ParameterWhenSet,
+		ChannelMode_Flag,
+	};
+
+	for (const PrefixInfo& info : prefixes)
+	{
+		if (info.modesym == mode)
+			return ChannelMode_Status;
+	}
+
+	for (int i = 0; i < channelModes.size() && i < (int) COUNT_OF (types); ++i)
+	{
+		if (channelModes[i].contains (QChar (mode)))
+			return types[i];
+	}
+
+	// Unknown modes are assumed not to take arguments.
+	return ChannelMode_Flag;
+}
+
+// =============================================================================
+//
+IRCUser* IRCConnection::findUser (const QString& nickname, bool createIfNeeded)
+{
+	const QString key = foldCase (nickname);
+	IRCUser* user = users.value (key);
+
+	if (user == null && createIfNeeded)
+	{
+		user = new IRCUser (this);
 		user->nickname = nickname;
-		users << user;
-		return user;
+		users.insert (key, user);
 	}
 
-	return null;
+	return user;
 }
 
 // =============================================================================
 //
 void IRCConnection::forgetUser (IRCUser* user)
 {
-	users.removeOne (user);
+	const QString key = foldCase (user->nickname);
+
+	if (users.value (key) == user)
+		users.remove (key);
+}
+
+// =============================================================================
+//
+// Changes the nickname of @user and moves it in the nickname indices. If some
+// other user is still known by the new nickname, we missed them leaving and
+// they are dropped like after a quit. If that is ourselves, our own nickname is
+// out of sync instead; we must stay reachable, so the index entry is kept and
+// @user is only renamed.
+//
+void IRCConnection::renameUser (IRCUser* user, const QString& newnick)
+{
+	const QString oldnick = user->nickname;
+	IRCUser* stale = users.value (foldCase (newnick));
+
+	if (stale == ourselves && user != ourselves)
+	{
+		warning (format (tr ("%1 is now known as %2, but so are we?"), oldnick, newnick));
+		forgetUser (user);
+		user->nickname = newnick;
+
+		for (IRCChannel* chan : user->channels)
+			chan->userRenamed (user, oldnick);
+
+		return;
+	}
+
+	if (stale != null && stale != user)
+	{
+		warning (format (tr ("%1 is now known as %2, but %2 is still around? Forgetting the latter."),
+			oldnick, newnick));
+		delete stale;
+	}
+
+	forgetUser (user);
+	user->nickname = newnick;
+	users.insert (foldCase (newnick), user);
+
+	for (IRCChannel* chan : user->channels)
+		chan->userRenamed (user, oldnick);
+}
+
+// =============================================================================
+//
+// Handles IRCv3 batches. Netsplit and netjoin batches are collected and
+// announced as one when they end, other types of batches are not treated
+// specially.
+//
+void IRCConnection::processBatch (const IRCMessage& msg)
+{
+	const QString reference = msg.param (0).toString();
+
+	if (reference.length() < 2)
+	{
+		warning (format (tr ("Recieved illegible BATCH from server: %1"), msg.raw()));
+		return;
+	}
+
+	if (reference[0] == '+')
+	{
+		const QStringRef type = msg.param (1);
+
+		if (type == QLatin1String ("netsplit") || type == QLatin1String ("netjoin"))
+		{
+			NetsplitBatch batch;
+			batch.servers = msg.paramsFrom (2);
+			batch.isJoin = (type == QLatin1String ("netjoin"));
+			batch.isHeuristic = false;
+			netsplitBatches.insert (reference.mid (1), batch);
+		}
+	}
+	elif (reference[0] == '-')
+		finishBatch (reference.mid (1));
+}
+
+// =============================================================================
+//
+// Returns the netsplit batch @msg is tagged to be a part of, if any.
+//
+NetsplitBatch* IRCConnection::batchOf (const IRCMessage& msg)
+{
+	const QStringRef id = msg.tag ("batch");
+
+	if (id.isEmpty())
+		return null;
+
+	auto it = netsplitBatches.find (id.toString());
+	return (it != netsplitBatches.end()) ? &it.value() : null;
+}
+
+// =============================================================================
+//
+// Gets the batch of a netsplit between @servers detected from quit messages.
+// The batch ends once no more quits or joins have arrived for a while.
+//
+NetsplitBatch* IRCConnection::heuristicBatch (const QString& servers, bool isJoin)
+{
+	const QString id = (isJoin ? "join " : "split ") + servers;
+	auto it = netsplitBatches.find (id);
+
+	if (it == netsplitBatches.end())
+	{
+		NetsplitBatch batch;
+		batch.servers = servers;
+		batch.isJoin = isJoin;
+		batch.isHeuristic = true;
+		it = netsplitBatches.insert (id, batch);
+	}
+
+	netsplitTimer->start (cfg::netsplit_delay);
+	return &it.value();
+}
+
+// =============================================================================
+//
+// Adds @nickname to @batch in @chan. The userlist of the channel is not updated
+// until the batch is finished.
+//
+void IRCConnection::addToBatch (NetsplitBatch& batch, IRCChannel* chan, const QString& nickname)
+{
+	auto it = batch.nicknames.find (chan);
+
+	if (it == batch.nicknames.end())
+	{
+		chan->beginUserlistBatch();
+		it = batch.nicknames.insert (chan, QStringList());
+	}
+
+	it.value() << nickname;
+}
+
+// =============================================================================
+//
+// Ends the batch @id, printing one line per channel about it.
+//
+void IRCConnection::finishBatch (const QString& id)
+{
+	auto it = netsplitBatches.find (id);
+
+	if (it == netsplitBatches.end())
+		return;
+
+	const NetsplitBatch batch = it.value();
+	netsplitBatches.erase (it);
+	QString servers = batch.servers;
+	servers.replace (" ", " <-> ");
+
+	for (auto chanIt = batch.nicknames.begin(); chanIt != batch.nicknames.end(); ++chanIt)
+	{
+		IRCChannel* chan = chanIt.key();
+		const QStringList& nicknames = chanIt.value();
+		QString list = QStringList (nicknames.mid (0, 20)).join (", ");
+
+		if (nicknames.size() > 20)
+			list += format (tr (" and %1 more"), nicknames.size() - 20);
+
+		if (batch.isJoin)
+		{
+			chan->context->print (format (tr ("-> Netsplit %1 is over, %2 users have returned: %3"),
+				servers, nicknames.size(), list));
+		}
+		else
+		{
+			chan->context->print (format (tr ("<- Netsplit %1, %2 users have disconnected: %3"),
+				servers, nicknames.size(), list));
+		}
+
+		chan->endUserlistBatch();
+	}
+
+	// The users who returned don't need to be remembered any more.
+	if (batch.isJoin)
+	{
+		for (const QStringList& nicknames : batch.nicknames)
+		{
+			for (const QString& nickname : nicknames)
+				splitUsers.remove (foldCase (nickname));
+		}
+	}
+}
+
+// =============================================================================
+//
+void IRCConnection::finishHeuristicBatches() // [slot]
+{
+	for (const QString& id : netsplitBatches.keys())
+	{
+		if (netsplitBatches[id].isHeuristic)
+			finishBatch (id);
+	}
 }
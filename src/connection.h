@@ -4,9 +4,15 @@
 #include "main.h"
 #include <QObject>
 #include <QAbstractSocket>
+#include <QHash>
+#include <QElapsedTimer>
+#include "linebuffer.h"
+#include "message.h"
+#include "sendqueue.h"
 
 class IRCUser;
 class IRCChannel;
+class IRCConnection;
 class Context;
 class QTcpSocket;
 class QTimer;
@@ -23,6 +29,32 @@ enum EConnectionState
 	EConnected,
 };
 
+// =====================================================================
+//
+// How nicknames and channel names are compared, as set by the CASEMAPPING
+// token of RPL_ISUPPORT.
+//
+enum ECaseMapping
+{
+	CaseMapping_Ascii,
+	CaseMapping_RFC1459,
+	CaseMapping_StrictRFC1459,
+};
+
+// =====================================================================
+//
+// How a channel mode takes arguments, as told by the PREFIX and CHANMODES
+// tokens of RPL_ISUPPORT.
+//
+enum ChannelModeType
+{
+	ChannelMode_List,				// type A: always takes an argument, e.g. +b
+	ChannelMode_Parameter,			// type B: always takes an argument, e.g. +k
+	ChannelMode_ParameterWhenSet,	// type C: takes an argument when set, e.g. +l
+	ChannelMode_Flag,				// type D: never takes an argument, e.g. +n
+	ChannelMode_Status,				// member status, e.g. +o
+};
+
 // =====================================================================
 //
 // IRC server reply codes.. not a comprehensive list
@@ -86,12 +118,37 @@ enum EReplyCode
 	Reply_NeedMoreParams		= 461,
 };
 
+using IRCMessageHandler = void (IRCConnection::*) (const IRCMessage&);
+
 struct PrefixInfo
 {
 	char	modesym;
 	char	prefix;
 };
 
+// =====================================================================
+//
+// Quits or joins of a netsplit, collected to be announced all at once. Batches
+// come either from IRCv3 BATCH or are detected from quit messages.
+//
+struct NetsplitBatch
+{
+	QString							servers;		// the servers which split
+	bool							isJoin;
+	bool							isHeuristic;	// not from BATCH
+	QMap<IRCChannel*, QStringList>	nicknames;
+};
+
+// =====================================================================
+//
+// A user lost in a netsplit, remembered to recognize them when they return.
+//
+struct SplitUser
+{
+	QString		servers;
+	qint64		time;
+};
+
 class IRCConnection : public QObject
 {
 public:
@@ -104,13 +161,31 @@ public:
 	PROPERTY (QString hostname)
 	PROPERTY (quint16 port)
 	PROPERTY (EConnectionState state)
-	PROPERTY (QString lineWork)
+	PROPERTY (ECaseMapping caseMapping)
+	PROPERTY (StringMap supported)
+	PROPERTY (QList<PrefixInfo> prefixes)
+	PROPERTY (QStringList channelModes)
+	PROPERTY (LineBuffer receiveBuffer)
 	PROPERTY (QList<IRCChannel*> channels)
 	PROPERTY (IRCUser* ourselves)
 
 	PROPERTY (QTcpSocket* socket)
 	PROPERTY (QTimer* timer)
-	PROPERTY (QList<IRCUser*> users)
+	PROPERTY (QTimer* sendTimer)
+	PROPERTY (SendQueue sendQueue)
+	PROPERTY (QElapsedTimer clock)
+	PROPERTY (qint64 bytesSent)
+	PROPERTY (qint64 bytesReceived)
+	PROPERTY (int sendRate)
+	PROPERTY (int receiveRate)
+	PROPERTY (qint64 rateTime)
+	PROPERTY (qint64 rateBytesSent)
+	PROPERTY (qint64 rateBytesReceived)
+	PROPERTY (QHash<QString, IRCUser*> users)
+	PROPERTY (QHash<QString, NetsplitBatch> netsplitBatches)
+	PROPERTY (QHash<QString, SplitUser> splitUsers)
+	PROPERTY (QTimer* netsplitTimer)
+	PROPERTY (qint64 splitPurgeTime)
 
 	CLASSDATA (IRCConnection)
 
@@ -122,10 +197,16 @@ public:
 	void			connectToServer();
 	void			disconnectFromServer (QString quitmessage = "");
 	IRCChannel*		findChannel (QString name, bool createIfNeeded = false);
-	IRCUser*		findUser (QString nickname, bool createIfNeeded = false);
+	IRCUser*		findUser (const QString& nickname, bool createIfNeeded = false);
+	QString			foldCase (const QString& text) const;
+	ChannelModeType	getChannelModeType (char mode) const;
+	char			getPrefixMode (char prefix) const;
 	void			forgetUser (IRCUser* user);
 	void			removeChannel (IRCChannel* a);
-	void			write (QString text);
+	void			renameUser (IRCUser* user, const QString& newnick);
+	int				sendQueueDepth() const;
+	void			setCaseMapping (ECaseMapping mapping);
+	void			write (QString text, SendPriority priority = SendPriority_Normal);
 
 	static const QList<IRCConnection*>& getAllConnections();
 
@@ -133,20 +214,43 @@ public slots:
 	void readyRead();
 	void writeLogin();
 
-	void processMessage (QString msg);
+	void processLine (const char* data, int length);
+	void processMessage (const IRCMessage& msg);
 	void print (QString msg);
 	void warning (QString msg);
-	void parseNumeric (QString msg, QStringList tokens, int num);
-	void processJoin (QString msg, QStringList tokens);
-	void processPart (QString msg, QStringList tokens);
-	void processQuit (QString msg, QStringList tokens);
-	void processPrivmsg (QString msg, QStringList tokens);
-	void processTopicChange (QString msg, QStringList tokens);
 
 private slots:
+	void finishHeuristicBatches();
+	void flushSendQueue();
 	void tick();
 	void processConnectionError (QAbstractSocket::SocketError err);
-	void processMode (QString msg, QStringList tokens);
+
+private:
+	void processBatch (const IRCMessage& msg);
+	void processEndOfNames (const IRCMessage& msg);
+	void processJoin (const IRCMessage& msg);
+	void processMode (const IRCMessage& msg);
+	void processChannelModeIs (const IRCMessage& msg);
+	void processNameReply (const IRCMessage& msg);
+	void processNick (const IRCMessage& msg);
+	void processPart (const IRCMessage& msg);
+	void processPing (const IRCMessage& msg);
+	void processPrivmsg (const IRCMessage& msg);
+	void processQuit (const IRCMessage& msg);
+	void processServerText (const IRCMessage& msg);
+	void processSupported (const IRCMessage& msg);
+	void processTopicChange (const IRCMessage& msg);
+	void processTopicReply (const IRCMessage& msg);
+	void processTopicSetAt (const IRCMessage& msg);
+	void processWelcome (const IRCMessage& msg);
+
+	void			addToBatch (NetsplitBatch& batch, IRCChannel* chan, const QString& nickname);
+	NetsplitBatch*	batchOf (const IRCMessage& msg);
+	void			finishBatch (const QString& id);
+	NetsplitBatch*	heuristicBatch (const QString& servers, bool isJoin);
+	void			setPrefixes (const QString& token);
+
+	static void initDispatchTables();
 };
 
 #endif // COIRC_CONNECTION_H
@@ -4,30 +4,58 @@
 #include "connection.h"
 #include "mainwindow.h"
 #include "misc.h"
-#include <QTextDocument>
+#include "config.h"
+#include "timestamp.h"
+#include "logsegment.h"
+#include "logwriter.h"
+#include <QTextCharFormat>
+#include <QHash>
+#include <QVector>
 #include <QTreeWidget>
+#include <QTimer>
 #include <typeinfo>
 
-static const QString gColorCodes[] =
-{
-	"#FFFFFF", // white
-	"#000000", // black
-	"#0000A0", // dark blue
-	"#008000", // dark green
-	"#A00000", // red
-	"#800000", // dark red
-	"#800080", // dark purple
-	"#FF8000", // orange
-	"#FFFF00", // yellow
-	"#40FF00", // light green
-	"#00FFFF", // cyan
-	"#8080FF", // sky blue
-	"#FF80FF", // light purple
-	"#808080", // gray
-	"#404040", // dark gray
+// The mIRC color palette. Colors 16 to 98 are the extended colors.
+static const uint g_colorPalette[] =
+{
+	0xFFFFFF, // white
+	0x000000, // black
+	0x0000A0, // dark blue
+	0x008000, // dark green
+	0xA00000, // red
+	0x800000, // dark red
+	0x800080, // dark purple
+	0xFF8000, // orange
+	0xFFFF00, // yellow
+	0x40FF00, // light green
+	0x00FFFF, // cyan
+	0x8080FF, // sky blue
+	0xFF80FF, // light purple
+	0x808080, // gray
+	0x404040, // dark gray
+	0xC0C0C0, // light gray
+	0x470000, 0x472100, 0x474700, 0x324700, 0x004700, 0x00472C,
+	0x004747, 0x002747, 0x000047, 0x2E0047, 0x470047, 0x47002A,
+	0x740000, 0x743A00, 0x747400, 0x517400, 0x007400, 0x007449,
+	0x007474, 0x004074, 0x000074, 0x4B0074, 0x740074, 0x740045,
+	0xB50000, 0xB56300, 0xB5B500, 0x7DB500, 0x00B500, 0x00B571,
+	0x00B5B5, 0x0063B5, 0x0000B5, 0x7500B5, 0xB500B5, 0xB5006B,
+	0xFF0000, 0xFF8C00, 0xFFFF00, 0xB2FF00, 0x00FF00, 0x00FFA0,
+	0x00FFFF, 0x008CFF, 0x0000FF, 0xA500FF, 0xFF00FF, 0xFF0098,
+	0xFF5959, 0xFFB459, 0xFFFF71, 0xCFFF60, 0x6FFF6F, 0x65FFC9,
+	0x6DFFFF, 0x59B4FF, 0x5959FF, 0xC459FF, 0xFF66FF, 0xFF59BC,
+	0xFF9C9C, 0xFFD39C, 0xFFFF9C, 0xE2FF9C, 0x9CFF9C, 0x9CFFDB,
+	0x9CFFFF, 0x9CD3FF, 0x9C9CFF, 0xDC9CFF, 0xFF9CFF, 0xFF94D3,
+	0x000000, 0x131313, 0x282828, 0x363636, 0x4D4D4D, 0x656565,
+	0x818181, 0x9F9F9F, 0xBCBCBC, 0xE2E2E2, 0xFFFFFF,
 };
 
-static const int						gNumColorCodes = COUNT_OF (gColorCodes);
+static_assert (COUNT_OF (g_colorPalette) == 99, "the color palette must have 99 colors");
+
+CONFIG (Int, scrollback_lines,	10000)	// maximum amount of lines kept per context
+CONFIG (Int, scrollback_kbytes,	2048)	// maximum amount of text kept per context
+CONFIG (Int, scrollback_restore_lines, 500)	// lines restored from the log when a context is first shown
+
 static QMap<QTreeWidgetItem*, Context*>	g_contextsByTreeItem;
 static Context*							g_currentContext = null;
 static QList<Context*>					g_allContexts;
@@ -35,164 +63,285 @@ static QMap<int, Context*>				g_contextsByID;
 
 // =============================================================================
 //
-static void writeColors (QString& out, QString color1, QString color2)
+// Formatting state of IRC text. Colors are RGB values, or -1 for the default.
+//
+struct TextStyle
+{
+	int		foreground = -1;
+	int		background = -1;
+	bool	bold = false;
+	bool	italic = false;
+	bool	underline = false;
+	bool	strikeOut = false;
+	bool	monospace = false;
+	bool	reverse = false;
+
+	bool operator== (const TextStyle& other) const
+	{
+		return foreground == other.foreground
+			&& background == other.background
+			&& bold == other.bold
+			&& italic == other.italic
+			&& underline == other.underline
+			&& strikeOut == other.strikeOut
+			&& monospace == other.monospace
+			&& reverse == other.reverse;
+	}
+
+	bool operator!= (const TextStyle& other) const
+	{
+		return !operator== (other);
+	}
+};
+
+// =============================================================================
+//
+// Reads a color number of at most two digits at @i, advancing @i past it.
+// Returns -1 if there is no number at @i.
+//
+static int readColorNumber (const QChar* data, int length, int& i)
 {
-	if (!color2.isEmpty())
-		out += format ("<span style=\"color: %1; background-color: %2;\">", color1, color2);
-	else
-		out += format ("<span style=\"color: %1;\">", color1);
+	int result = -1;
+
+	for (int n = 0; n < 2 && i < length && isWithinRange<ushort> (data[i].unicode(), '0', '9'); ++n)
+		result = qMax (result, 0) * 10 + (data[i++].unicode() - '0');
+
+	return result;
 }
 
 // =============================================================================
 //
-// Converts @in from IRC formatting into HTML formatting. If @replaceEscapeCodes is
-// set, special sequences are also replaced (e.g. "\\b" with bold)
+// Reads a six-digit hex color at @i into @rgb, advancing @i past it. Returns
+// false if there is no hex color at @i.
 //
-enum EConversionFlag
+static bool readHexColor (const QChar* data, int length, int i, int& rgb)
 {
-	FReplaceEscapeCodes	= (1 << 0),
-	FRemoveCodes		= (1 << 1),
-};
+	if (length - i < 6)
+		return false;
 
-Q_DECLARE_FLAGS (FConversionFlags, EConversionFlag)
-Q_DECLARE_OPERATORS_FOR_FLAGS (FConversionFlags)
-
-static QString convertToHTML (QString in, FConversionFlags flags)
-{
-	QString			color1,
-					color2;
-	bool			boldactive = false;
-	const QRegExp	colorMask ("(\\d\\d?)(;\\d\\d?)?"); // regex for colors, e.g. 4;12
-	QString			out;
-	bool			underlineActive = false;
-
-	// The string more than most probably does not end with a normalizer character,
-	// so append one now. This ensures all tags are closed properly and nothing will
-	// bleed out of this string into the document.
-	in += NORMAL_STR;
-
-	// Replace escape codes now. We allow this in internal printing, since it also uses
-	// this function and writing "\\bargh" is more convenient than writing BOLD_STR
-	// "argh". @replaceEscapeCodes is false in privmsg messages coming from the IRC
-	// server so that if someone includes \u in their actual message it doesn't turn
-	// into an underline formatting code.
-	if (flags & FReplaceEscapeCodes)
+	rgb = 0;
+
+	for (int n = 0; n < 6; ++n)
 	{
-		in.replace ("\\b", BOLD_STR);
-		in.replace ("\\c", COLOR_STR);
-		in.replace ("\\o", NORMAL_STR);
-		in.replace ("\\r", REVERSE_STR);
-		in.replace ("\\u", UNDERLINE_STR);
+		const ushort c = data[i + n].unicode();
+		int digit;
+
+		if (isWithinRange<ushort> (c, '0', '9'))
+			digit = c - '0';
+		elif (isWithinRange<ushort> (c, 'a', 'f'))
+			digit = c - 'a' + 10;
+		elif (isWithinRange<ushort> (c, 'A', 'F'))
+			digit = c - 'A' + 10;
+		else
+			return false;
+
+		rgb = (rgb << 4) | digit;
 	}
 
-	// Replace some special characters with entities so the HTML doesn't get messed up.
-	// note: `&` first! otherwise `<` will turn into &amp;lt;
-	in.replace ("&", "&amp;");
-	in.replace ("<", "&lt;");
-	in.replace (">", "&gt;");
+	return true;
+}
 
-	// Now handle mIRC-like formatting
-	for (int i = 0; i < in.size(); ++i)
+// =============================================================================
+//
+// Maps a palette color number to RGB. 99 and anything out of range mean the
+// default color.
+//
+static int paletteColor (int number)
+{
+	if (isWithinRange<int> (number, 0, COUNT_OF (g_colorPalette) - 1))
+		return g_colorPalette[number];
+
+	return -1;
+}
+
+// =============================================================================
+//
+// Gets the colors @style is displayed with, taking reverse into account.
+//
+static void resolveColors (const TextStyle& style, int& foreground, int& background)
+{
+	foreground = style.foreground;
+	background = style.background;
+
+	if (style.reverse)
 	{
-		switch (in[i].toAscii())
-		{
-		case BOLD_CHAR:
-		{
-			toggle (boldactive);
-			out += (boldactive) ? "<b>" : "</b>";
-		} break;
+		qSwap (foreground, background);
 
-		case UNDERLINE_CHAR:
-		{
-			toggle (underlineActive);
-			out += (underlineActive) ? "<u>" : "</u>";
-		} break;
+		if (foreground == -1)
+			foreground = g_colorPalette[0];
 
-		case COLOR_CHAR:
+		if (background == -1)
+			background = g_colorPalette[1];
+	}
+}
+
+// =============================================================================
+//
+// Gets the character format for @style. Formats are cached so that lines with
+// the same formatting share them.
+//
+static QTextCharFormat charFormatFor (const TextStyle& style)
+{
+	static QHash<quint64, QTextCharFormat> cache;
+	int foreground, background;
+	resolveColors (style, foreground, background);
+
+	// 25 bits for each color (the default color being 1 << 24) and a bit for
+	// each flag.
+	const quint64 key = quint64 (foreground == -1 ? 0x1000000 : foreground)
+		| (quint64 (background == -1 ? 0x1000000 : background) << 25)
+		| (quint64 (style.bold) << 50)
+		| (quint64 (style.italic) << 51)
+		| (quint64 (style.underline) << 52)
+		| (quint64 (style.strikeOut) << 53)
+		| (quint64 (style.monospace) << 54);
+
+	auto it = cache.find (key);
+
+	if (it != cache.end())
+		return it.value();
+
+	QTextCharFormat charFormat;
+
+	if (foreground != -1)
+		charFormat.setForeground (QColor (QRgb (foreground)));
+
+	if (background != -1)
+		charFormat.setBackground (QColor (QRgb (background)));
+
+	if (style.bold)
+		charFormat.setFontWeight (QFont::Bold);
+
+	charFormat.setFontItalic (style.italic);
+	charFormat.setFontUnderline (style.underline);
+	charFormat.setFontStrikeOut (style.strikeOut);
+
+	if (style.monospace)
+	{
+		charFormat.setFontFamily ("monospace");
+		charFormat.setFontFixedPitch (true);
+	}
+
+	cache.insert (key, charFormat);
+	return charFormat;
+}
+
+// =============================================================================
+//
+// A stretch of text with uniform formatting, as offsets into the plain text
+// returned by parseFormatting().
+//
+struct FormatRun
+{
+	int			start;
+	int			length;
+	TextStyle	style;
+};
+
+// =============================================================================
+//
+// Splits @in into plain text and the runs of formatting over it in a single
+// pass. Formatting codes only change the pending style; a run is started when
+// text follows with a different style. The plain text is returned.
+//
+static QString parseFormatting (const QString& in, QVector<FormatRun>& runs)
+{
+	const QChar* const data = in.constData();
+	const int length = in.size();
+	TextStyle style;
+	QString out;
+	out.reserve (length);
+	runs.clear();
+
+	for (int i = 0; i < length;)
+	{
+		const ushort c = data[i++].unicode();
+
+		switch (c)
 		{
-			if (colorMask.indexIn (in.mid (i + 1)) != -1)
-			{
-				assert (colorMask.capturedTexts().size() == 3);
-				QString	num1str = colorMask.capturedTexts() [1],
-						num2str = colorMask.capturedTexts() [2];
-				int		num1,
-						num2 = -1;
+		case BOLD_CHAR:
+			toggle (style.bold);
+			break;
 
-				num1 = num1str.toInt();
+		case ITALIC_CHAR:
+			toggle (style.italic);
+			break;
 
-				if (!num2str.isEmpty())
-				{
-					// The regex capture includes the separating ';' as well, rid
-					// it now.
-					assert (num2str[0] == ';');
-					num2str.remove (0, 1);
-
-					// Note: the regexp does not allow num2str to be -1 since
-					// it only allows digits, so assert is enough here.
-					num2 = num2str.toInt();
-					assert (num2 != -1);
-				}
+		case UNDERLINE_CHAR:
+			toggle (style.underline);
+			break;
 
-				if (isWithinRange (num1, 0, gNumColorCodes - 1) && isWithinRange (num2, -1, gNumColorCodes - 1))
-				{
-					color1 = gColorCodes[num1];
-					color2 = (num2 != -1) ? gColorCodes[num2] : "";
+		case STRIKE_CHAR:
+			toggle (style.strikeOut);
+			break;
 
-					writeColors (out, color1, color2);
-					i += colorMask.matchedLength();
-				}
-			}
+		case MONOSPACE_CHAR:
+			toggle (style.monospace);
+			break;
 
-			elif (!color1.isEmpty())
-			{
-				out += "</span>";
-				color1 = color2 = "";
-			}
-		} break;
+		case REVERSE_CHAR:
+			toggle (style.reverse);
+			break;
 
 		case NORMAL_CHAR:
+			style = TextStyle();
+			break;
+
+		case COLOR_CHAR:
 		{
-			if (boldactive)
-			{
-				out += "</b>";
-				boldactive = false;
-			}
+			// ^Cfg[,bg] where both are one or two digits. A bare ^C resets
+			// the colors.
+			const int foreground = readColorNumber (data, length, i);
 
-			if (underlineActive)
+			if (foreground == -1)
 			{
-				out += "</u>";
-				underlineActive = false;
+				style.foreground = style.background = -1;
+				break;
 			}
 
-			if (!color1.isEmpty())
+			style.foreground = paletteColor (foreground);
+
+			if (i + 1 < length && data[i] == ',' && data[i + 1].isDigit())
 			{
-				out += "</span>";
-				color1 = color2 = "";
+				i++;
+				style.background = paletteColor (readColorNumber (data, length, i));
 			}
 		} break;
 
-		case REVERSE_CHAR:
+		case HEXCOLOR_CHAR:
 		{
-			if (color1.isEmpty())
-				color1 = gColorCodes[1];
-			else
-				out += "</span>";
+			// ^DRRGGBB[,RRGGBB], likewise.
+			int rgb;
 
-			if (color2.isEmpty())
-				color2 = gColorCodes[0];
+			if (readHexColor (data, length, i, rgb) == false)
+			{
+				style.foreground = style.background = -1;
+				break;
+			}
 
-			color1.swap (color2);
-			writeColors (out, color1, color2);
-		} break;
+			style.foreground = rgb;
+			i += 6;
 
-		case '\n':
-		{
-			out += "<br />";
+			if (i < length && data[i] == ',' && readHexColor (data, length, i + 1, rgb))
+			{
+				style.background = rgb;
+				i += 7;
+			}
 		} break;
 
 		default:
 		{
-			out += in[i];
+			if (runs.isEmpty() || runs.last().style != style)
+			{
+				FormatRun run;
+				run.start = out.size();
+				run.length = 0;
+				run.style = style;
+				runs << run;
+			}
+
+			out += QChar (c);
+			runs.last().length++;
 		} break;
 		}
 	}
@@ -200,6 +349,20 @@ static QString convertToHTML (QString in, FConversionFlags flags)
 	return out;
 }
 
+// =============================================================================
+//
+// Gets the text of @line as displayed, with the timestamp in front.
+//
+static QString lineText (const ContextLine& line)
+{
+	QString text = QString::fromUtf8 (line.text);
+
+	if (line.time != 0)
+		text.prepend (formatTimestamp (line.time));
+
+	return text;
+}
+
 // =============================================================================
 //
 Context::Context (IRCConnection* conn) :
@@ -225,8 +388,6 @@ Context::Context (IRCChannel* channel) :
 	target = u;
 	parentContext = channel->connection->context;
 	commonInit();
-
-	IRCChannel::connect (channel, SIGNAL (userlistChanged()), win, SLOT (updateUserlist()));
 }
 
 // =============================================================================
@@ -252,7 +413,11 @@ void Context::commonInit()
 		id++;
 
 	treeItem = new QTreeWidgetItem;
-	document = new QTextDocument;
+	scrollbackBytes = 0;
+	firstLineNumber = 0;
+	isFlushScheduled = false;
+	creationTime = QDateTime::currentMSecsSinceEpoch();
+	isRestorePending = true;
 
 	if (parentContext != null)
 		parentContext->addSubContext (this);
@@ -269,6 +434,9 @@ Context::~Context()
 	if (parentContext)
 		parentContext->forgetSubContext (this);
 
+	if (g_currentContext == this)
+		setCurrentContext (null);
+
 	g_allContexts.removeOne (this);
 	g_contextsByID.remove (id);
 	delete treeItem;
@@ -327,6 +495,9 @@ Context* Context::currentContext() // [static]
 //
 void Context::setCurrentContext (Context* context) // [static]
 {
+	if (context != null && context->isRestorePending)
+		context->restoreScrollback();
+
 	g_currentContext = context;
 	win->updateOutputWidget();
 }
@@ -361,31 +532,324 @@ QString Context::getName() const
 
 // =============================================================================
 //
-void Context::rawPrint (QString msg, bool replaceEscapeCodes)
+// Makes @name usable as a file name. Names starting with a dot are reserved
+// for the log writer's own files, like the search index.
+//
+static QString sanitizeLogName (QString name)
 {
-	FConversionFlags flags = 0;
+	static const QString unsafe ("/\\:*?\"<>|");
 
-	if (replaceEscapeCodes)
-		flags |= FReplaceEscapeCodes;
+	for (int i = 0; i < name.length(); ++i)
+	{
+		if (unsafe.contains (name[i]) || name[i].unicode() < 0x20)
+			name[i] = '_';
+	}
 
-	html += convertToHTML (msg, flags);
-	document->setHtml (html);
+	if (name.startsWith ('.'))
+		name[0] = '_';
+
+	return name;
+}
+
+// =============================================================================
+//
+// Returns how the channel or nick @name on @connection appears in log names.
+// Names are folded with the casemapping of the server so that all spellings of
+// a name share one log.
+//
+QString Context::logNameOf (IRCConnection* connection, const QString& name) // [static]
+{
+	return sanitizeLogName (connection->foldCase (name));
+}
+
+// =============================================================================
+//
+// Returns the name of the on-disk log of this context, relative to the log
+// directory. Channels and queries are logged under the hostname of their
+// server.
+//
+QString Context::getLogName() const
+{
+	switch (type)
+	{
+		case CTX_Channel:
+			return sanitizeLogName (target.chan->connection->hostname) + "/"
+				+ logNameOf (target.chan->connection, target.chan->name);
+
+		case CTX_Query:
+			return sanitizeLogName (target.user->connection->hostname) + "/"
+				+ logNameOf (target.user->connection, target.user->nickname);
+
+		case CTX_Server:
+			return sanitizeLogName (target.conn->hostname);
+	}
+
+	return "";
+}
+
+// =============================================================================
+//
+// Stores @text as one or more lines. Escape codes are allowed in internal
+// printing, since writing "\\bargh" is more convenient than writing BOLD_STR
+// "argh". They are resolved in the first @escapedLength characters of @text
+// only, so that if someone includes \u in their actual message it doesn't
+// turn into an underline code. Nothing is rendered here, the output view lays
+// out the lines it displays itself.
+//
+void Context::printLines (const QString& text, int escapedLength, const QString& nick,
+	bool isLogged)
+{
+	const QChar* const data = text.constData();
+	const int length = text.endsWith ("\n") ? text.length() - 1 : text.length();
+	const qint64 now = QDateTime::currentMSecsSinceEpoch();
+	const QString logName = isLogged ? getLogName() : QString();
+	QString piece;
+	bool isFirstLine = true;
+
+	for (int i = 0; i <= length; ++i)
+	{
+		if (i < length && data[i] != '\n')
+		{
+			QChar c = data[i];
+
+			if (c == '\\' && i + 1 < escapedLength)
+			{
+				switch (data[i + 1].unicode())
+				{
+					case 'b': c = BOLD_CHAR; break;
+					case 'c': c = COLOR_CHAR; break;
+					case 'o': c = NORMAL_CHAR; break;
+					case 'r': c = REVERSE_CHAR; break;
+					case 'u': c = UNDERLINE_CHAR; break;
+				}
+
+				if (c != '\\')
+					i++;
+			}
+
+			piece += c;
+			continue;
+		}
+
+		ContextLine line;
+		line.time = isFirstLine ? now : 0;
+		line.text = piece.toUtf8();
+		scrollbackBytes += line.text.size();
+		lines.enqueue (line);
+		piece.clear();
+		isFirstLine = false;
+
+		if (isLogged)
+			LogWriter::log (logName, line.time, line.text, nick);
+	}
+
+	trimScrollback();
+
+	// The output view is told about new lines once at the end of this event
+	// loop turn, however many lines are printed before that. Contexts which
+	// are not being displayed don't need to tell anyone.
+	if (g_currentContext == this && isFlushScheduled == false)
+	{
+		isFlushScheduled = true;
+		QTimer::singleShot (0, this, SLOT (flushPendingLines()));
+	}
+}
+
+// =============================================================================
+//
+void Context::flushPendingLines() // [slot]
+{
+	isFlushScheduled = false;
+	emit linesChanged();
+}
+
+// =============================================================================
+//
+// Gets the displayed text of @line into @text and the formatting over it into
+// @formats, for laying the line out with QTextLayout.
+//
+void Context::formatLine (const ContextLine& line, QString& text,
+	QList<QTextLayout::FormatRange>& formats) // [static]
+{
+	QVector<FormatRun> runs;
+	text = parseFormatting (lineText (line), runs);
+	formats.clear();
+
+	for (const FormatRun& run : runs)
+	{
+		if (run.style == TextStyle())
+			continue;
+
+		QTextLayout::FormatRange range;
+		range.start = run.start;
+		range.length = run.length;
+		range.format = charFormatFor (run.style);
+		formats << range;
+	}
 }
 
 // =============================================================================
 //
-void Context::printTimestamp()
+// Returns the offset of the last record with a time among the records from the
+// one at @offset, which is line @lineNumber, up to line @lastLine. Returns -1 if
+// they are all continuation lines.
+//
+static qint64 lastTimedRecord (const LogSegmentReader& reader, qint64 offset, qint64 lineNumber,
+	qint64 lastLine)
+{
+	qint64 result = -1;
+	qint64 time;
+
+	for (; lineNumber <= lastLine && offset != -1; ++lineNumber)
+	{
+		const qint64 next = reader.nextRecord (offset, &time);
+
+		if (next != -1 && time != 0)
+			result = offset;
+
+		offset = next;
+	}
+
+	return result;
+}
+
+// =============================================================================
+//
+// Reads the last @count lines from before @boundary out of the segment open in
+// @reader, and the lines before those up to the start of the message the first
+// of them belongs to. The index of the segment is used to skip to the lines
+// needed, only those are decoded.
+//
+static QList<ContextLine> readLogTail (const LogSegmentReader& reader, qint64 boundary, int count)
+{
+	const QVector<LogIndexEntry>& index = reader.index();
+	QList<ContextLine> result;
+	qint64 offset = LogHeaderSize;
+	qint64 lineNumber = 0;
+	qint64 next;
+	qint64 time;
+
+	for (int i = index.size() - 1; i >= 0; --i)
+	{
+		if (index[i].time < boundary)
+		{
+			offset = index[i].offset;
+			lineNumber = index[i].lineNumber;
+			break;
+		}
+	}
+
+	// Find where the lines from the boundary on start. Continuation lines go
+	// with the line they continue.
+	while ((next = reader.nextRecord (offset, &time)) != -1 && time < boundary)
+	{
+		offset = next;
+		lineNumber++;
+	}
+
+	const qint64 end = offset;
+	const qint64 startLine = qMax<qint64> (lineNumber - count, 0);
+	int entry = index.size() - 1;
+
+	while (entry >= 0 && index[entry].lineNumber > startLine)
+		entry--;
+
+	// Continuation lines can't be shown without the line they continue, so
+	// start at the nearest line with a time at or before the start line,
+	// going further back in the index if needed.
+	for (offset = -1; offset == -1 && entry >= -1; --entry)
+	{
+		if (entry >= 0)
+			offset = lastTimedRecord (reader, index[entry].offset, index[entry].lineNumber, startLine);
+		else
+			offset = lastTimedRecord (reader, LogHeaderSize, 0, startLine);
+	}
+
+	// If the segment starts with continuation lines, those are skipped.
+	if (offset == -1)
+		offset = LogHeaderSize;
+
+	while (offset != -1 && offset < end)
+	{
+		ContextLine line;
+		offset = reader.readRecord (offset, line.time, line.text);
+
+		if (offset != -1 && (line.time != 0 || result.isEmpty() == false))
+			result << line;
+	}
+
+	return result;
+}
+
+// =============================================================================
+//
+// Fills the scrollback with the last lines logged before this context was
+// created. This is done once the context is first shown rather than when it is
+// created so that contexts which are never looked at cost nothing. The lines
+// are numbered backwards from the first line printed so far.
+//
+void Context::restoreScrollback()
+{
+	const int wanted = qMin (cfg::scrollback_restore_lines, cfg::scrollback_lines);
+	const QStringList paths = LogSegmentWriter::segmentPaths (LogWriter::logDirectory (getLogName()));
+	QList<ContextLine> restored;
+	isRestorePending = false;
+
+	for (int i = paths.size() - 1; i >= 0 && restored.size() < wanted; --i)
+	{
+		LogSegmentReader reader;
+
+		if (reader.open (paths[i]))
+			restored = readLogTail (reader, creationTime, wanted - restored.size()) + restored;
+	}
+
+	if (restored.isEmpty())
+		return;
+
+	for (const ContextLine& line : restored)
+		scrollbackBytes += line.text.size();
+
+	firstLineNumber -= restored.size();
+	restored.append (lines);
+	lines = QQueue<ContextLine>();
+	lines.append (restored);
+	trimScrollback();
+}
+
+// =============================================================================
+//
+// Evicts the oldest lines until the scrollback fits within both the line cap
+// and the byte budget. The newest line is always kept. Lines are numbered from
+// the start of the context, so numbers stay valid across evictions.
+//
+void Context::trimScrollback()
 {
-	QString tstamp = QDateTime::currentDateTime().toString ("hh:mm:ss");
-	rawPrint (format ("\\c2[%1]\\o ", tstamp), true);
+	const qint64 maxBytes = qint64 (cfg::scrollback_kbytes) * 1024;
+	const int maxLines = qMax (cfg::scrollback_lines, 1);
+
+	while (lines.size() > 1 && (lines.size() > maxLines || scrollbackBytes > maxBytes))
+	{
+		scrollbackBytes -= lines.dequeue().text.size();
+		firstLineNumber++;
+	}
 }
 
 // =============================================================================
 //
 void Context::print (QString text)
 {
-	printTimestamp();
-	rawPrint (text + "\n", true);
+	printLines (text, text.length());
+}
+
+// =============================================================================
+//
+// Prints @text after @prefix without logging it, for output which is not part
+// of the conversation such as search results. Escape codes are only resolved
+// in the prefix so that @text is shown as it is.
+//
+void Context::printNote (QString prefix, const QString& text)
+{
+	printLines (prefix + NORMAL_STR + text, prefix.length(), QString(), false);
 }
 
 // =============================================================================
@@ -414,16 +878,12 @@ IRCConnection* Context::getConnection()
 //
 void Context::writeIRCMessage (QString from, QString msg)
 {
-	printTimestamp();
-	rawPrint (format ("<\\b%1\\b> ", from), true);
-	rawPrint (msg + "\n", false);
+	printLines (format ("<" BOLD_STR "%1" BOLD_STR "> " NORMAL_STR, from) + msg, 0, from);
 }
 
 // =============================================================================
 //
 void Context::writeIRCAction (QString from, QString msg)
 {
-	printTimestamp();
-	rawPrint (format ("* \\b%1\\b ", from), true);
-	rawPrint (msg + "\n", false);
+	printLines (format ("* " BOLD_STR "%1" BOLD_STR " " NORMAL_STR, from) + msg, 0, from);
 }
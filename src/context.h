@@ -4,12 +4,13 @@
 #include "main.h"
 #include <QObject>
 #include <QTreeWidget>
+#include <QQueue>
+#include <QTextLayout>
 
 class Context;
 class IRCConnection;
 class IRCChannel;
 class IRCUser;
-class QTextDocument;
 
 enum ContextType
 {
@@ -18,10 +19,22 @@ enum ContextType
 	CTX_Server,
 };
 
+// =============================================================================
+//
+// A printed line, stored compactly until it needs to be displayed. Formatting is
+// kept inline as IRC control codes.
+//
+struct ContextLine
+{
+	qint64		time;	// msec since the epoch, 0 for continuation lines
+	QByteArray	text;	// UTF-8
+};
+
 // =============================================================================
 // -----------------------------------------------------------------------------
 class Context final : public QObject
 {
+	Q_OBJECT
 	DELETE_COPY (Context)
 
 public:
@@ -33,13 +46,17 @@ public:
 	};
 
 	PROPERTY (QTreeWidgetItem* treeItem)
-	PROPERTY (QTextDocument* document)
 	PROPERTY (QList<Context*> subContexts)
 	PROPERTY (Context* parentContext)
 	PROPERTY (TargetUnion target)
 	PROPERTY (ContextType type)
 	PROPERTY (int id)
-	PROPERTY (QString html)
+	PROPERTY (QQueue<ContextLine> lines)
+	PROPERTY (qint64 scrollbackBytes)
+	PROPERTY (qint64 firstLineNumber)
+	PROPERTY (bool isFlushScheduled)
+	PROPERTY (qint64 creationTime)
+	PROPERTY (bool isRestorePending)
 	CLASSDATA (Context)
 
 public:
@@ -51,15 +68,20 @@ public:
 	void							addSubContext (Context* child);
 	void							forgetSubContext (Context* child);
 	IRCConnection*					getConnection();
+	QString							getLogName() const;
 	QString							getName() const;
 	void							print (QString text);
+	void							printNote (QString prefix, const QString& text);
 	void							updateTreeItem();
 	void							writeIRCMessage (QString from, QString msg);
 	void							writeIRCAction (QString from, QString msg);
 
+	static void						formatLine (const ContextLine& line, QString& text,
+										QList<QTextLayout::FormatRange>& formats);
 	static Context*					fromTreeWidgetItem (QTreeWidgetItem* item);
 	static const QList<Context*>&	allContexts();
 	static Context*					currentContext();
+	static QString					logNameOf (IRCConnection* connection, const QString& name);
 	static void						setCurrentContext (Context* context);
 
 	static inline void printToCurrent (QString msg)
@@ -67,10 +89,18 @@ public:
 		Context::currentContext()->print (msg);
 	}
 
+signals:
+	void linesChanged();
+
+private slots:
+	void flushPendingLines();
+
 private:
 	void commonInit();
-	void printTimestamp();
-	void rawPrint (QString msg, bool replaceEscapeCodes);
+	void printLines (const QString& text, int escapedLength, const QString& nick = QString(),
+		bool isLogged = true);
+	void restoreScrollback();
+	void trimScrollback();
 };
 
 // ============================================================================
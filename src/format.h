@@ -31,6 +31,7 @@ class StringFormatArg
 {
 	public:
 		StringFormatArg (const QString& a) : m_text (a) {}
+		StringFormatArg (const QStringRef& a) : m_text (a.toString()) {}
 		StringFormatArg (const char& a) : m_text (a) {}
 		StringFormatArg (const uchar& a) : m_text (a) {}
 		StringFormatArg (const QChar& a) : m_text (a) {}
@@ -0,0 +1,84 @@
+#include <cstring>
+#include "linebuffer.h"
+
+// =============================================================================
+//
+LineBuffer::LineBuffer (int capacity) :
+	data (capacity, '\0'),
+	begin (0),
+	end (0),
+	scanPosition (0) {}
+
+// =============================================================================
+//
+void LineBuffer::clear()
+{
+	begin = end = scanPosition = 0;
+}
+
+// =============================================================================
+//
+// Returns a pointer to at least @minimumSpace bytes of writable space at the
+// end of the buffer. The actual amount of space is written to @space. Once the
+// data has been written, commitWrite() must be called with the amount of bytes.
+//
+char* LineBuffer::prepareWrite (int minimumSpace, int& space)
+{
+	if (data.size() - end < minimumSpace && begin > 0)
+	{
+		// Out of room at the end, move the unterminated tail to the front.
+		const int pending = end - begin;
+		memmove (data.data(), data.data() + begin, pending);
+		scanPosition -= begin;
+		begin = 0;
+		end = pending;
+	}
+
+	if (data.size() - end < minimumSpace)
+		data.resize (qMax (data.size() * 2, end + minimumSpace));
+
+	space = data.size() - end;
+	return data.data() + end;
+}
+
+// =============================================================================
+//
+void LineBuffer::commitWrite (int bytes)
+{
+	assert (bytes >= 0 && end + bytes <= data.size());
+	end += bytes;
+}
+
+// =============================================================================
+//
+// Finds the next complete line in the buffer. Both LF and CRLF are accepted as
+// line terminators, the terminator is not included in @length. The pointer
+// written to @line stays valid until the next call to prepareWrite().
+//
+bool LineBuffer::nextLine (const char*& line, int& length)
+{
+	const char* base = data.constData();
+	const char* newline = static_cast<const char*> (
+		memchr (base + scanPosition, '\n', end - scanPosition));
+
+	if (newline == null)
+	{
+		// No complete line here. Don't scan these bytes again next time.
+		scanPosition = end;
+		return false;
+	}
+
+	line = base + begin;
+	length = newline - line;
+
+	if (length > 0 && line[length - 1] == '\r')
+		length--;
+
+	begin = scanPosition = (newline - base) + 1;
+
+	// If everything was consumed, rewind to the start of the buffer for free.
+	if (begin == end)
+		begin = end = scanPosition = 0;
+
+	return true;
+}
@@ -0,0 +1,37 @@
+#ifndef SPEECHBUBBLE_LINEBUFFER_H
+#define SPEECHBUBBLE_LINEBUFFER_H
+
+#include <QByteArray>
+#include "main.h"
+
+// =============================================================================
+//
+// Byte-level receive buffer which frames incoming data into lines. Data is read
+// straight into the buffer and complete lines are handed out as pointers into
+// it. The unterminated tail stays where it is until the buffer runs out of room,
+// at which point it is moved to the front once.
+//
+class LineBuffer
+{
+public:
+	PROPERTY (QByteArray data)
+	PROPERTY (int begin)
+	PROPERTY (int end)
+	PROPERTY (int scanPosition)
+	CLASSDATA (LineBuffer)
+
+public:
+	LineBuffer (int capacity = 16384);
+
+	void		clear();
+	void		commitWrite (int bytes);
+	bool		nextLine (const char*& line, int& length);
+	char*		prepareWrite (int minimumSpace, int& space);
+
+	inline int pendingBytes() const
+	{
+		return end - begin;
+	}
+};
+
+#endif // SPEECHBUBBLE_LINEBUFFER_H
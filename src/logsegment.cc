@@ -0,0 +1,652 @@
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+#include "logsegment.h"
+
+// =============================================================================
+//
+static void writeHeader (QFile& file, quint32 magic, qint64 startTime)
+{
+	uchar buffer[LogHeaderSize];
+	qToLittleEndian<quint32> (magic, buffer);
+	qToLittleEndian<quint16> (LogFormatVersion, buffer + 4);
+	qToLittleEndian<quint16> (0, buffer + 6);
+	qToLittleEndian<qint64> (startTime, buffer + 8);
+	file.write (reinterpret_cast<const char*> (buffer), sizeof buffer);
+}
+
+// =============================================================================
+//
+static QString compressedPath (const QString& segmentPath)
+{
+	return segmentPath.left (segmentPath.lastIndexOf ('.')) + ".sbz";
+}
+
+// =============================================================================
+//
+LogSegmentWriter::LogSegmentWriter (const QString& directory, qint64 maximumSize) :
+	m_directory (directory),
+	m_maximumSize (maximumSize),
+	m_startTime (0),
+	m_size (0),
+	m_lineCount (0),
+	m_linesSinceIndex (0),
+	m_hasFailed (false) {}
+
+// =============================================================================
+//
+// Reads the header of a segment or an index file and checks that it is of the
+// format written by this version.
+//
+bool LogSegmentWriter::readHeader (QFile& file, quint32 magic, LogFileHeader& header) // [static]
+{
+	uchar buffer[LogHeaderSize];
+
+	if (file.seek (0) == false
+		|| file.read (reinterpret_cast<char*> (buffer), sizeof buffer) != sizeof buffer)
+	{
+		return false;
+	}
+
+	header.magic = qFromLittleEndian<quint32> (buffer);
+	header.version = qFromLittleEndian<quint16> (buffer + 4);
+	header.flags = qFromLittleEndian<quint16> (buffer + 6);
+	header.startTime = qFromLittleEndian<qint64> (buffer + 8);
+	return header.magic == magic && header.version == LogFormatVersion;
+}
+
+// =============================================================================
+//
+// The file name is the start time padded with zeros so that sorting segments by
+// name sorts them by time as well.
+//
+QString LogSegmentWriter::segmentPath (const QString& directory, qint64 startTime) // [static]
+{
+	return format ("%1/%2.sblog", directory, QString ("%1").arg (startTime, 16, 10, QChar ('0')));
+}
+
+// =============================================================================
+//
+QString LogSegmentWriter::indexPath (const QString& segmentPath) // [static]
+{
+	return segmentPath.left (segmentPath.lastIndexOf ('.')) + ".sbidx";
+}
+
+// =============================================================================
+//
+// Returns the path of the segment starting at @startTime in @directory, which
+// may have been compressed.
+//
+QString LogSegmentWriter::findSegment (const QString& directory, qint64 startTime) // [static]
+{
+	const QString path = segmentPath (directory, startTime);
+
+	if (QFile::exists (path))
+		return path;
+
+	return compressedPath (path);
+}
+
+// =============================================================================
+//
+// Returns the paths of the segments in @directory, oldest first. If compressing
+// a segment was interrupted before the uncompressed one was removed, the
+// uncompressed one is used.
+//
+QStringList LogSegmentWriter::segmentPaths (const QString& directory) // [static]
+{
+	QDir dir (directory);
+	QMap<QString, QString> paths;
+	const QStringList filters = QStringList() << "*.sblog" << "*.sbz";
+
+	for (const QString& name : dir.entryList (filters, QDir::Files))
+	{
+		const QString startTime = QFileInfo (name).completeBaseName();
+
+		if (paths.contains (startTime) == false || name.endsWith (".sblog"))
+			paths[startTime] = dir.filePath (name);
+	}
+
+	return paths.values();
+}
+
+// =============================================================================
+//
+bool LogSegmentWriter::isOpen() const
+{
+	return m_segment.isOpen();
+}
+
+// =============================================================================
+//
+// Opens the newest segment of the log to continue it, or starts a new one if it
+// is full or unreadable.
+//
+bool LogSegmentWriter::open (qint64 time)
+{
+	if (QDir().mkpath (m_directory) == false)
+	{
+		fprint (stderr, "couldn't create log directory %1\n", m_directory);
+		return false;
+	}
+
+	const QStringList paths = segmentPaths (m_directory);
+
+	if (paths.isEmpty() == false
+		&& paths.last().endsWith (".sblog")
+		&& QFileInfo (paths.last()).size() < m_maximumSize
+		&& recover (paths.last()))
+	{
+		return true;
+	}
+
+	return create (time);
+}
+
+// =============================================================================
+//
+bool LogSegmentWriter::create (qint64 time)
+{
+	const QString path = segmentPath (m_directory, time);
+	m_segment.setFileName (path);
+	m_index.setFileName (indexPath (path));
+
+	if (m_segment.open (QIODevice::WriteOnly | QIODevice::Truncate) == false
+		|| m_index.open (QIODevice::WriteOnly | QIODevice::Truncate) == false)
+	{
+		fprint (stderr, "couldn't create log segment %1\n", path);
+		close();
+		return false;
+	}
+
+	writeHeader (m_segment, LogSegmentMagic, time);
+	writeHeader (m_index, LogIndexMagic, time);
+	m_startTime = time;
+	m_size = LogHeaderSize;
+	m_lineCount = 0;
+	m_linesSinceIndex = LogIndexInterval;
+	return true;
+}
+
+// =============================================================================
+//
+// Reopens the segment at @path for appending. Lines after the last index entry
+// are counted again and a record which was only partially written when the
+// program last stopped is cut off. A missing or broken index is rebuilt.
+//
+bool LogSegmentWriter::recover (const QString& path)
+{
+	LogFileHeader header;
+	LogFileHeader indexHeader;
+	qint64 offset = LogHeaderSize;
+	m_segment.setFileName (path);
+	m_index.setFileName (indexPath (path));
+	m_lineCount = 0;
+	m_linesSinceIndex = LogIndexInterval;
+
+	if (m_segment.open (QIODevice::ReadWrite) == false
+		|| readHeader (m_segment, LogSegmentMagic, header) == false
+		|| m_index.open (QIODevice::ReadWrite) == false)
+	{
+		close();
+		return false;
+	}
+
+	const qint64 fileSize = m_segment.size();
+	m_startTime = header.startTime;
+
+	if (readHeader (m_index, LogIndexMagic, indexHeader) == false)
+	{
+		m_index.resize (0);
+		m_index.seek (0);
+		writeHeader (m_index, LogIndexMagic, header.startTime);
+	}
+	else
+	{
+		// Continue from the last whole entry which points into the segment.
+		qint64 count = (m_index.size() - LogHeaderSize) / LogIndexEntrySize;
+
+		for (; count > 0; --count)
+		{
+			uchar buffer[LogIndexEntrySize];
+			m_index.seek (LogHeaderSize + (count - 1) * LogIndexEntrySize);
+
+			if (m_index.read (reinterpret_cast<char*> (buffer), sizeof buffer) == sizeof buffer
+				&& qFromLittleEndian<qint64> (buffer + 8) < fileSize)
+			{
+				offset = qFromLittleEndian<qint64> (buffer + 8);
+				m_lineCount = qFromLittleEndian<qint64> (buffer + 16);
+				m_linesSinceIndex = 0;
+				break;
+			}
+		}
+
+		m_index.resize (LogHeaderSize + count * LogIndexEntrySize);
+		m_index.seek (m_index.size());
+	}
+
+	while (offset + LogRecordHeaderSize <= fileSize)
+	{
+		uchar buffer[LogRecordHeaderSize];
+
+		if (m_segment.seek (offset) == false
+			|| m_segment.read (reinterpret_cast<char*> (buffer), sizeof buffer) != sizeof buffer)
+		{
+			break;
+		}
+
+		const qint64 time = qFromLittleEndian<qint64> (buffer + 4);
+		const qint64 end = offset + LogRecordHeaderSize + qFromLittleEndian<quint32> (buffer);
+
+		if (end > fileSize)
+			break;
+
+		if (time != 0 && m_linesSinceIndex >= LogIndexInterval)
+			writeIndexEntry (time, offset);
+
+		offset = end;
+		m_lineCount++;
+		m_linesSinceIndex++;
+	}
+
+	m_segment.resize (offset);
+	m_segment.seek (offset);
+	m_size = offset;
+	return true;
+}
+
+// =============================================================================
+//
+void LogSegmentWriter::writeIndexEntry (qint64 time, qint64 offset)
+{
+	uchar buffer[LogIndexEntrySize];
+	qToLittleEndian<qint64> (time, buffer);
+	qToLittleEndian<qint64> (offset, buffer + 8);
+	qToLittleEndian<qint64> (m_lineCount, buffer + 16);
+	m_index.write (reinterpret_cast<const char*> (buffer), sizeof buffer);
+	m_linesSinceIndex = 0;
+}
+
+// =============================================================================
+//
+// Appends a line to the log. Returns the offset of its record in the current
+// segment, or -1 if the log could not be written.
+//
+qint64 LogSegmentWriter::append (qint64 time, const QByteArray& text)
+{
+	if (m_hasFailed)
+		return -1;
+
+	// Segments are only split before a timestamped line so that no segment
+	// starts with a continuation line.
+	if (isOpen() && time != 0 && m_size >= m_maximumSize)
+		close();
+
+	if (isOpen() == false)
+	{
+		if (open (time != 0 ? time : QDateTime::currentMSecsSinceEpoch()) == false)
+		{
+			// Don't try again for every line, this log stays off until restart.
+			m_hasFailed = true;
+			return -1;
+		}
+	}
+
+	const qint64 offset = m_size;
+
+	if (time != 0 && m_linesSinceIndex >= LogIndexInterval)
+		writeIndexEntry (time, offset);
+
+	uchar buffer[LogRecordHeaderSize];
+	qToLittleEndian<quint32> (text.size(), buffer);
+	qToLittleEndian<qint64> (time, buffer + 4);
+	m_segment.write (reinterpret_cast<const char*> (buffer), sizeof buffer);
+	m_segment.write (text);
+	m_size += LogRecordHeaderSize + text.size();
+	m_lineCount++;
+	m_linesSinceIndex++;
+	return offset;
+}
+
+// =============================================================================
+//
+// Returns the path of the current segment.
+//
+QString LogSegmentWriter::path() const
+{
+	return m_segment.fileName();
+}
+
+// =============================================================================
+//
+// Returns the start time of the current segment, which names its file.
+//
+qint64 LogSegmentWriter::startTime() const
+{
+	return m_startTime;
+}
+
+// =============================================================================
+//
+// Compresses the sealed segment at @path block by block into a .sbz file and
+// removes the segment once that is in place.
+//
+bool LogSegmentWriter::compress (const QString& path) // [static]
+{
+	const QString target = compressedPath (path);
+	QFile source (path);
+	QFile output (target + ".tmp");
+	LogFileHeader header;
+
+	// An earlier run got as far as putting the compressed file in place.
+	if (QFile::exists (target))
+		return QFile::remove (path);
+
+	if (source.open (QIODevice::ReadOnly) == false
+		|| readHeader (source, LogSegmentMagic, header) == false)
+	{
+		return false;
+	}
+
+	const qint64 size = source.size();
+	const uchar* data = source.map (0, size);
+	const qint64 blockCount = (size + LogBlockSize - 1) / LogBlockSize;
+	QVector<qint64> offsets;
+	uchar buffer[LogCompressedHeaderSize];
+
+	if (data == null || output.open (QIODevice::WriteOnly | QIODevice::Truncate) == false)
+		return false;
+
+	qToLittleEndian<quint32> (LogCompressedMagic, buffer);
+	qToLittleEndian<quint16> (LogFormatVersion, buffer + 4);
+	qToLittleEndian<quint16> (0, buffer + 6);
+	qToLittleEndian<qint64> (header.startTime, buffer + 8);
+	qToLittleEndian<quint64> (size, buffer + 16);
+	qToLittleEndian<quint32> (LogBlockSize, buffer + 24);
+	qToLittleEndian<quint32> (blockCount, buffer + 28);
+	output.write (reinterpret_cast<const char*> (buffer), sizeof buffer);
+
+	// The block table is written once the blocks are.
+	qint64 position = LogCompressedHeaderSize + ((blockCount + 1) * 8);
+	output.seek (position);
+
+	for (qint64 i = 0; i < blockCount; ++i)
+	{
+		const qint64 start = i * LogBlockSize;
+		const QByteArray block = qCompress (data + start, qMin<qint64> (LogBlockSize, size - start));
+		offsets << position;
+		output.write (block);
+		position += block.size();
+	}
+
+	offsets << position;
+	output.seek (LogCompressedHeaderSize);
+
+	for (qint64 offset : offsets)
+	{
+		uchar entry[8];
+		qToLittleEndian<qint64> (offset, entry);
+		output.write (reinterpret_cast<const char*> (entry), sizeof entry);
+	}
+
+	output.close();
+	source.close();
+
+	if (output.error() != QFile::NoError || QFile::rename (output.fileName(), target) == false)
+	{
+		QFile::remove (output.fileName());
+		return false;
+	}
+
+	return QFile::remove (path);
+}
+
+// =============================================================================
+//
+void LogSegmentWriter::flush()
+{
+	if (isOpen())
+	{
+		m_segment.flush();
+		m_index.flush();
+	}
+}
+
+// =============================================================================
+//
+void LogSegmentWriter::close()
+{
+	m_segment.close();
+	m_index.close();
+}
+
+// =============================================================================
+//
+LogSegmentReader::LogSegmentReader() :
+	m_data (null),
+	m_size (0),
+	m_isCompressed (false),
+	m_blockSize (0),
+	m_windowStart (0) {}
+
+// =============================================================================
+//
+void LogSegmentReader::close()
+{
+	m_file.close();
+	m_data = null;
+	m_size = 0;
+	m_index.clear();
+	m_isCompressed = false;
+	m_blockOffsets.clear();
+	m_window.clear();
+	m_windowStart = 0;
+}
+
+// =============================================================================
+//
+// Maps the segment at @path and reads its index. Index entries are only kept
+// if they point into the mapped part of the segment. If an uncompressed segment
+// has been compressed since its path was looked up, the compressed one is read
+// instead.
+//
+bool LogSegmentReader::open (const QString& path)
+{
+	QFile indexFile (LogSegmentWriter::indexPath (path));
+	LogFileHeader header;
+	close();
+	m_file.setFileName (path);
+	m_isCompressed = path.endsWith (".sbz");
+
+	if (m_file.open (QIODevice::ReadOnly))
+	{
+		m_size = m_file.size();
+		m_data = m_file.map (0, m_size);
+	}
+	elif (m_isCompressed == false && QFile::exists (path) == false)
+		return open (compressedPath (path));
+
+	if (m_data == null || (m_isCompressed && openCompressed() == false))
+	{
+		close();
+		return false;
+	}
+
+	const uchar* segmentHeader = bytesAt (0, LogHeaderSize);
+
+	if (segmentHeader == null
+		|| qFromLittleEndian<quint32> (segmentHeader) != LogSegmentMagic
+		|| qFromLittleEndian<quint16> (segmentHeader + 4) != LogFormatVersion)
+	{
+		close();
+		return false;
+	}
+
+	if (indexFile.open (QIODevice::ReadOnly)
+		&& LogSegmentWriter::readHeader (indexFile, LogIndexMagic, header))
+	{
+		const QByteArray data = indexFile.readAll();
+		const uchar* entry = reinterpret_cast<const uchar*> (data.constData());
+
+		for (int i = 0; i + LogIndexEntrySize <= data.size(); i += LogIndexEntrySize)
+		{
+			LogIndexEntry decoded;
+			decoded.time = qFromLittleEndian<qint64> (entry + i);
+			decoded.offset = qFromLittleEndian<qint64> (entry + i + 8);
+			decoded.lineNumber = qFromLittleEndian<qint64> (entry + i + 16);
+
+			if (decoded.offset >= m_size)
+				break;
+
+			m_index << decoded;
+		}
+	}
+
+	return true;
+}
+
+// =============================================================================
+//
+// Reads the header and the block table of a compressed segment. Afterwards
+// m_size is the size of the uncompressed segment.
+//
+bool LogSegmentReader::openCompressed()
+{
+	const qint64 fileSize = m_size;
+
+	if (fileSize < LogCompressedHeaderSize
+		|| qFromLittleEndian<quint32> (m_data) != LogCompressedMagic
+		|| qFromLittleEndian<quint16> (m_data + 4) != LogFormatVersion)
+	{
+		return false;
+	}
+
+	m_size = qFromLittleEndian<quint64> (m_data + 16);
+	m_blockSize = qFromLittleEndian<quint32> (m_data + 24);
+	const qint64 blockCount = qFromLittleEndian<quint32> (m_data + 28);
+
+	if (m_blockSize <= 0
+		|| blockCount != (m_size + m_blockSize - 1) / m_blockSize
+		|| LogCompressedHeaderSize + ((blockCount + 1) * 8) > fileSize)
+	{
+		return false;
+	}
+
+	for (qint64 i = 0; i <= blockCount; ++i)
+	{
+		const qint64 offset = qFromLittleEndian<qint64> (m_data + LogCompressedHeaderSize + (i * 8));
+
+		if (offset > fileSize || (i > 0 && offset < m_blockOffsets.last()))
+			return false;
+
+		m_blockOffsets << offset;
+	}
+
+	return true;
+}
+
+// =============================================================================
+//
+// Returns a pointer to @length bytes at @offset of the segment, or null if the
+// segment is not that long. Of a compressed segment, the blocks with the bytes
+// are decompressed unless they already were, and the pointer stays valid
+// until the next call.
+//
+const uchar* LogSegmentReader::bytesAt (qint64 offset, qint64 length) const
+{
+	if (offset < 0 || length <= 0 || offset + length > m_size)
+		return null;
+
+	if (m_isCompressed == false)
+		return m_data + offset;
+
+	if (offset < m_windowStart || offset + length > m_windowStart + m_window.size())
+	{
+		const qint64 first = offset / m_blockSize;
+		const qint64 last = (offset + length - 1) / m_blockSize;
+		m_window.clear();
+		m_windowStart = first * m_blockSize;
+
+		for (qint64 i = first; i <= last; ++i)
+		{
+			const qint64 start = m_blockOffsets[i];
+			const QByteArray block = qUncompress (m_data + start, m_blockOffsets[i + 1] - start);
+
+			if (block.isEmpty())
+			{
+				m_window.clear();
+				return null;
+			}
+
+			m_window += block;
+		}
+
+		if (offset + length > m_windowStart + m_window.size())
+			return null;
+	}
+
+	return reinterpret_cast<const uchar*> (m_window.constData()) + (offset - m_windowStart);
+}
+
+// =============================================================================
+//
+// The index entries of the segment, in ascending order of both time and line
+// number.
+//
+const QVector<LogIndexEntry>& LogSegmentReader::index() const
+{
+	return m_index;
+}
+
+// =============================================================================
+//
+// Returns the offset of the record after the one at @offset and writes the time
+// of the record at @offset to @time. Returns -1 if there is no whole record at
+// @offset.
+//
+qint64 LogSegmentReader::nextRecord (qint64 offset, qint64* time) const
+{
+	const uchar* record = bytesAt (offset, LogRecordHeaderSize);
+
+	if (offset < LogHeaderSize || record == null)
+		return -1;
+
+	const qint64 end = offset + LogRecordHeaderSize + qFromLittleEndian<quint32> (record);
+
+	if (end > m_size)
+		return -1;
+
+	if (time != null)
+		*time = qFromLittleEndian<qint64> (record + 4);
+
+	return end;
+}
+
+// =============================================================================
+//
+// Reads the record at @offset. Returns the offset of the next record, or -1 if
+// there is no whole record at @offset.
+//
+qint64 LogSegmentReader::readRecord (qint64 offset, qint64& time, QByteArray& text) const
+{
+	const qint64 next = nextRecord (offset, &time);
+	const qint64 length = next - offset - LogRecordHeaderSize;
+
+	if (next == -1)
+		return -1;
+
+	if (length == 0)
+	{
+		text.clear();
+		return next;
+	}
+
+	const uchar* data = bytesAt (offset + LogRecordHeaderSize, length);
+
+	if (data == null)
+		return -1;
+
+	text = QByteArray (reinterpret_cast<const char*> (data), length);
+	return next;
+}
@@ -0,0 +1,141 @@
+#ifndef SPEECHBUBBLE_LOGSEGMENT_H
+#define SPEECHBUBBLE_LOGSEGMENT_H
+
+#include <QFile>
+#include <QVector>
+#include "main.h"
+
+// =============================================================================
+//
+// The on-disk log of a context is a directory of append-only segment files,
+// named after the time of their first line. Each segment comes with a sparse
+// index file which maps a timestamp to the offset of a line every now and then,
+// so that a position in the log can be found without reading all of it.
+//
+//     <time>.sblog:  header, record ...
+//     <time>.sbidx:  header, entry ...
+//     record:        quint32 length, qint64 time, length bytes of UTF-8 text
+//     entry:         qint64 time, qint64 offset, qint64 line number
+//
+// Once a segment is sealed it may be compressed. The segment file is cut into
+// blocks which are compressed with qCompress each, so that reading a record
+// only takes decompressing the blocks it is in. Offsets stay the same, they
+// are offsets into the uncompressed segment, so the index file is kept as is.
+//
+//     <time>.sbz:    header, quint64 size, quint32 block size,
+//                    quint32 block count, block table, block ...
+//     block table:   block count + 1 quint64 offsets of the blocks, the last
+//                    one being where the last block ends
+//
+// All integers are little-endian. A record of time 0 continues the line before
+// it, just like ContextLine does.
+//
+enum
+{
+	LogSegmentMagic		= 0x474C4253,	// "SBLG"
+	LogIndexMagic		= 0x58494253,	// "SBIX"
+	LogFormatVersion	= 1,
+	LogHeaderSize		= 16,
+	LogRecordHeaderSize	= 12,
+	LogIndexEntrySize	= 24,
+	LogIndexInterval	= 128,			// lines between index entries
+	LogCompressedMagic	= 0x5A4C4253,	// "SBLZ"
+	LogCompressedHeaderSize = 32,
+	LogBlockSize		= 65536,
+};
+
+struct LogFileHeader
+{
+	quint32		magic;
+	quint16		version;
+	quint16		flags;
+	qint64		startTime;
+};
+
+struct LogIndexEntry
+{
+	qint64		time;
+	qint64		offset;
+	qint64		lineNumber;
+};
+
+// =============================================================================
+//
+// Appends lines to the newest segment of one log, starting a new segment once
+// the current one has grown past the size limit. Only used by the log writer
+// thread.
+//
+class LogSegmentWriter
+{
+	DELETE_COPY (LogSegmentWriter)
+
+public:
+	LogSegmentWriter (const QString& directory, qint64 maximumSize);
+
+	qint64				append (qint64 time, const QByteArray& text);
+	void				close();
+	void				flush();
+	bool				isOpen() const;
+	QString				path() const;
+	qint64				startTime() const;
+
+	static bool			compress (const QString& path);
+	static QString		findSegment (const QString& directory, qint64 startTime);
+	static QString		indexPath (const QString& segmentPath);
+	static bool			readHeader (QFile& file, quint32 magic, LogFileHeader& header);
+	static QString		segmentPath (const QString& directory, qint64 startTime);
+	static QStringList	segmentPaths (const QString& directory);
+
+private:
+	bool				create (qint64 time);
+	bool				open (qint64 time);
+	bool				recover (const QString& path);
+	void				writeIndexEntry (qint64 time, qint64 offset);
+
+	QString				m_directory;
+	qint64				m_maximumSize;
+	QFile				m_segment;
+	QFile				m_index;
+	qint64				m_startTime;
+	qint64				m_size;
+	qint64				m_lineCount;
+	qint64				m_linesSinceIndex;
+	bool				m_hasFailed;
+};
+
+// =============================================================================
+//
+// Reads records from a segment of a log through a memory mapping of it, along
+// with its index. The segment may still be being written to, in which case only
+// the records which were there when it was opened are seen. Of a compressed
+// segment, the blocks last read from are kept decompressed.
+//
+class LogSegmentReader
+{
+	DELETE_COPY (LogSegmentReader)
+
+public:
+	LogSegmentReader();
+
+	const QVector<LogIndexEntry>&	index() const;
+	qint64							nextRecord (qint64 offset, qint64* time = null) const;
+	bool							open (const QString& path);
+	qint64							readRecord (qint64 offset, qint64& time, QByteArray& text) const;
+
+private:
+	const uchar*					bytesAt (qint64 offset, qint64 length) const;
+	void							close();
+	bool							openCompressed();
+
+	QFile							m_file;
+	const uchar*					m_data;
+	qint64							m_size;
+	QVector<LogIndexEntry>			m_index;
+	bool							m_isCompressed;
+	qint64							m_blockSize;
+	QVector<qint64>					m_blockOffsets;
+	mutable QByteArray				m_window;		// decompressed blocks
+	mutable qint64					m_windowStart;
+};
+
+#endif // SPEECHBUBBLE_LOGSEGMENT_H
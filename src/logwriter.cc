@@ -0,0 +1,375 @@
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QTimer>
+#include "logwriter.h"
+#include "logsegment.h"
+#include "searchindex.h"
+#include "config.h"
+
+CONFIG (Bool,	logging,			true)
+CONFIG (String,	log_directory,		"logs")
+CONFIG (Int,	log_segment_kbytes,	8192)	// size at which a log segment is sealed
+CONFIG (Bool,	log_compression,	true)	// compress sealed log segments
+
+enum
+{
+	OverflowRetry		= 10,		// msec between moving waiting lines into the ring
+	OverflowLimit		= 65536,	// lines kept waiting for the ring before lines are dropped
+	CompactionInterval	= 600000,	// msec between looking for segments to compress
+};
+
+static LogWriter* g_logWriter = null;
+
+// =============================================================================
+//
+LogRing::LogRing() :
+	m_head (0),
+	m_tail (0) {}
+
+// =============================================================================
+//
+// Adds @record to the queue. Returns false if the queue is full. @wasEmpty is
+// set if the consumer had taken every record before this one, in which case it
+// may be about to wait for more. Only called by the producer.
+//
+bool LogRing::push (const LogRecord& record, bool& wasEmpty)
+{
+	const unsigned tail = m_tail.load (std::memory_order_relaxed);
+
+	if (tail - m_head.load (std::memory_order_acquire) == Capacity)
+		return false;
+
+	m_records[tail % Capacity] = record;
+	m_tail.store (tail + 1, std::memory_order_seq_cst);
+
+	// Only looked at once the record is in: either the consumer sees the record
+	// when it next pops, or this sees that the consumer had popped everything.
+	wasEmpty = (m_head.load (std::memory_order_seq_cst) == tail);
+	return true;
+}
+
+// =============================================================================
+//
+// Takes the oldest record from the queue into @record. Returns false if the
+// queue is empty. Only called by the consumer.
+//
+bool LogRing::pop (LogRecord& record)
+{
+	const unsigned head = m_head.load (std::memory_order_relaxed);
+
+	if (head == m_tail.load (std::memory_order_seq_cst))
+		return false;
+
+	// Empty the slot too, so that the strings are released by this thread and
+	// not only once the slot is reused.
+	LogRecord& slot = m_records[head % Capacity];
+	record = slot;
+	slot = LogRecord();
+	m_head.store (head + 1, std::memory_order_seq_cst);
+	return true;
+}
+
+// =============================================================================
+//
+// Offsets into segments are 32-bit in the search index, so segments are kept
+// well below 4 GiB.
+//
+LogWriter::LogWriter() :
+	m_isStopping (false),
+	m_searchIndex (new SearchIndex (cfg::log_directory + "/.search-index")),
+	m_overflowTimer (new QTimer (this)),
+	m_droppedLines (0),
+	m_directory (cfg::log_directory),
+	m_segmentSize (qMin (qint64 (cfg::log_segment_kbytes) * 1024, qint64 (1) << 30)),
+	m_isCompressing (cfg::log_compression)
+{
+	connect (m_overflowTimer, SIGNAL (timeout()), this, SLOT (drainOverflow()));
+}
+
+// =============================================================================
+//
+LogWriter::~LogWriter()
+{
+	qDeleteAll (m_segments);
+	delete m_searchIndex;
+}
+
+// =============================================================================
+//
+void LogWriter::startLogging() // [static]
+{
+	if (cfg::logging == false || g_logWriter != null)
+		return;
+
+	g_logWriter = new LogWriter;
+	g_logWriter->start (QThread::LowPriority);
+}
+
+// =============================================================================
+//
+// Writes out everything that was logged so far and stops the writer thread.
+// Lines still waiting for room in the ring are written by this thread once the
+// writer thread is done.
+//
+void LogWriter::stopLogging() // [static]
+{
+	if (g_logWriter == null)
+		return;
+
+	g_logWriter->m_overflowTimer->stop();
+	g_logWriter->m_isStopping = true;
+	g_logWriter->m_wakeup.release();
+	g_logWriter->wait();
+
+	for (const LogRecord& record : g_logWriter->m_overflow)
+		g_logWriter->write (record);
+
+	g_logWriter->closeLogs();
+	delete g_logWriter;
+	g_logWriter = null;
+}
+
+// =============================================================================
+//
+// Returns the directory of the segments of log @logName.
+//
+QString LogWriter::logDirectory (const QString& logName) // [static]
+{
+	if (g_logWriter != null)
+		return g_logWriter->m_directory + "/" + logName;
+
+	return cfg::log_directory + "/" + logName;
+}
+
+// =============================================================================
+//
+// Returns the search index of the logs, or null if logging is disabled.
+//
+SearchIndex* LogWriter::searchIndex() // [static]
+{
+	return (g_logWriter != null) ? g_logWriter->m_searchIndex : null;
+}
+
+// =============================================================================
+//
+// Hands a line over to the writer thread. Never blocks.
+//
+void LogWriter::log (const QString& logName, qint64 time, const QByteArray& text,
+	const QString& nick) // [static]
+{
+	if (g_logWriter == null)
+		return;
+
+	LogRecord record;
+	record.logName = logName;
+	record.nick = nick;
+	record.time = time;
+	record.text = text;
+
+	if (g_logWriter->pushOverflow() && g_logWriter->push (record))
+		return;
+
+	// The ring is full. The line waits in the overflow queue until the next
+	// line is logged, unless the disk is so far behind that it would only
+	// pile up there.
+	if (g_logWriter->m_overflow.size() >= OverflowLimit)
+	{
+		if (g_logWriter->m_droppedLines++ == 0)
+			fprint (stderr, "log writer is not keeping up, dropping lines\n");
+
+		return;
+	}
+
+	g_logWriter->m_overflow.enqueue (record);
+
+	if (g_logWriter->m_overflowTimer->isActive() == false)
+		g_logWriter->m_overflowTimer->start (OverflowRetry);
+}
+
+// =============================================================================
+//
+// Adds @record to the ring, waking up the writer thread if it may be waiting
+// for lines. Returns false if the ring is full.
+//
+bool LogWriter::push (const LogRecord& record)
+{
+	bool wasEmpty;
+
+	if (m_ring.push (record, wasEmpty) == false)
+		return false;
+
+	if (wasEmpty)
+		m_wakeup.release();
+
+	return true;
+}
+
+// =============================================================================
+//
+// Moves lines from the overflow queue into the ring as long as there is room.
+// Returns true if the overflow queue is empty afterwards.
+//
+bool LogWriter::pushOverflow()
+{
+	while (m_overflow.isEmpty() == false)
+	{
+		if (push (m_overflow.head()) == false)
+			return false;
+
+		m_overflow.dequeue();
+	}
+
+	return true;
+}
+
+// =============================================================================
+//
+// Keeps moving lines from the overflow queue into the ring until it is empty,
+// so that they don't wait for more lines to be logged.
+//
+void LogWriter::drainOverflow() // [slot]
+{
+	if (pushOverflow())
+		m_overflowTimer->stop();
+}
+
+// =============================================================================
+//
+void LogWriter::run()
+{
+	LogRecord record;
+	m_searchIndex->load();
+	m_compactionTimer.start();
+
+	forever
+	{
+		// Every line pushed so far is about to be popped, so wake-ups for those
+		// are not needed any more. This is done before reading the flag so that
+		// the wake-up from stopLogging() is not lost.
+		m_wakeup.tryAcquire (m_wakeup.available());
+
+		// Read the flag before draining the ring so that whatever was pushed
+		// before stopLogging() set it still gets written.
+		const bool isStopping = m_isStopping;
+		bool wroteAny = false;
+
+		while (m_ring.pop (record))
+		{
+			write (record);
+			wroteAny = true;
+		}
+
+		if (wroteAny)
+		{
+			for (LogSegmentWriter* segment : m_segments)
+				segment->flush();
+		}
+
+		if (m_searchIndex->isFull())
+		{
+			m_searchIndex->flush();
+			m_searchIndex->mergeRuns();
+		}
+
+		if (isStopping)
+			break;
+
+		// Sleep until there are lines again, waking up for compaction.
+		if (wroteAny == false && compressColdSegment() == false)
+			m_wakeup.tryAcquire (1, m_isCompressing ? CompactionInterval : -1);
+	}
+}
+
+// =============================================================================
+//
+// Closes the segments and writes out the search index. Only called once the
+// writer thread has finished.
+//
+void LogWriter::closeLogs()
+{
+	for (LogSegmentWriter* segment : m_segments)
+		segment->close();
+
+	m_searchIndex->flush();
+}
+
+// =============================================================================
+//
+void LogWriter::write (const LogRecord& record)
+{
+	LogSegmentWriter*& segment = m_segments[record.logName];
+
+	if (segment == null)
+		segment = new LogSegmentWriter (m_directory + "/" + record.logName, m_segmentSize);
+
+	const qint64 offset = segment->append (record.time, record.text);
+
+	if (offset != -1)
+	{
+		m_searchIndex->addLine (record.logName, segment->startTime(), offset,
+			record.nick, record.text);
+	}
+}
+
+// =============================================================================
+//
+// Finds the segments which no more lines will be written to. Those are all but
+// the newest segment of each log, since a log is only ever continued in its
+// newest segment.
+//
+void LogWriter::findColdSegments()
+{
+	QMap<QString, QStringList> segmentsByLog;
+	QDirIterator it (m_directory, QStringList ("*.sblog"), QDir::Files, QDirIterator::Subdirectories);
+
+	while (it.hasNext())
+	{
+		const QString path = it.next();
+		segmentsByLog[QFileInfo (path).path()] << path;
+	}
+
+	for (QStringList& paths : segmentsByLog)
+	{
+		qSort (paths);
+		paths.removeLast();
+		m_coldSegments << paths;
+	}
+}
+
+// =============================================================================
+//
+// Compresses the next cold segment, looking for more every now and then. Only
+// called when there is nothing to write, so that compressing never delays
+// writing by more than one segment. Returns false if there was nothing to do.
+//
+bool LogWriter::compressColdSegment()
+{
+	if (m_isCompressing == false)
+		return false;
+
+	if (m_coldSegments.isEmpty())
+	{
+		if (m_compactionTimer.elapsed() < CompactionInterval)
+			return false;
+
+		m_compactionTimer.restart();
+		findColdSegments();
+
+		if (m_coldSegments.isEmpty())
+			return false;
+	}
+
+	const QString path = m_coldSegments.takeFirst();
+
+	// Just in case the clock went backwards and a newer segment sorts first.
+	for (LogSegmentWriter* segment : m_segments)
+	{
+		if (segment->isOpen() && segment->path() == path)
+			return true;
+	}
+
+	if (LogSegmentWriter::compress (path) == false)
+		fprint (stderr, "couldn't compress log segment %1\n", path);
+
+	return true;
+}
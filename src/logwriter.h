@@ -0,0 +1,114 @@
+#ifndef SPEECHBUBBLE_LOGWRITER_H
+#define SPEECHBUBBLE_LOGWRITER_H
+
+#include <atomic>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QQueue>
+#include <QSemaphore>
+#include <QThread>
+#include "main.h"
+
+class LogSegmentWriter;
+class QTimer;
+class SearchIndex;
+
+// =============================================================================
+//
+// A line on its way to the log named @logName, see Context::getLogName().
+// @nick is who said it, if anyone.
+//
+struct LogRecord
+{
+	QString		logName;
+	QString		nick;
+	qint64		time;
+	QByteArray	text;
+};
+
+// =============================================================================
+//
+// Fixed-size single-producer single-consumer queue of log records. The GUI
+// thread pushes and the log writer thread pops, neither one ever waits for the
+// other. The producer only writes the tail index and the consumer only writes
+// the head index, each after it is done with the slot. push() tells when the
+// consumer may have run out of records, so that it can wait until then.
+//
+class LogRing
+{
+	DELETE_COPY (LogRing)
+
+public:
+	enum
+	{
+		Capacity = 4096,	// must be a power of two
+	};
+
+	LogRing();
+
+	bool					pop (LogRecord& record);
+	bool					push (const LogRecord& record, bool& wasEmpty);
+
+private:
+	LogRecord				m_records[Capacity];
+	std::atomic<unsigned>	m_head;
+	std::atomic<unsigned>	m_tail;
+};
+
+// =============================================================================
+//
+// Writes the lines printed to contexts into their on-disk logs. Disk access
+// happens in a thread of its own so that a slow disk never holds up printing:
+// lines are handed over through a LogRing and the thread sleeps until the ring
+// has lines in it again. If the ring is full, lines wait in an overflow queue
+// in the GUI thread, which a timer keeps moving into the ring while there are
+// any. The thread also feeds the lines it writes into the search index, and
+// when there is nothing to write it compresses sealed segments which have not
+// been compressed yet, one at a time.
+//
+class LogWriter final : public QThread
+{
+	Q_OBJECT
+	DELETE_COPY (LogWriter)
+
+public:
+	static QString			logDirectory (const QString& logName);
+	static void				log (const QString& logName, qint64 time, const QByteArray& text,
+								const QString& nick);
+	static SearchIndex*		searchIndex();
+	static void				startLogging();
+	static void				stopLogging();
+
+protected:
+	void					run() override;
+
+private slots:
+	void					drainOverflow();
+
+private:
+	LogWriter();
+	~LogWriter();
+
+	void					closeLogs();
+	bool					compressColdSegment();
+	void					findColdSegments();
+	bool					push (const LogRecord& record);
+	bool					pushOverflow();
+	void					write (const LogRecord& record);
+
+	LogRing					m_ring;
+	QSemaphore				m_wakeup;				// released when the ring gets lines
+	std::atomic<bool>		m_isStopping;
+	SearchIndex*			m_searchIndex;
+	QHash<QString, LogSegmentWriter*> m_segments;	// writer thread only
+	QQueue<LogRecord>		m_overflow;				// GUI thread only
+	QTimer*					m_overflowTimer;		// GUI thread only
+	int						m_droppedLines;			// GUI thread only
+	QString					m_directory;
+	qint64					m_segmentSize;
+	bool					m_isCompressing;
+	QStringList				m_coldSegments;			// writer thread only
+	QElapsedTimer			m_compactionTimer;		// writer thread only
+};
+
+#endif // SPEECHBUBBLE_LOGWRITER_H
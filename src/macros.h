@@ -19,6 +19,12 @@
 #define REVERSE_CHAR		'\x16'
 #define ITALIC_CHAR			'\x1D'
 #define ITALIC_STR			"\x1D"
+#define HEXCOLOR_STR		"\x04"
+#define HEXCOLOR_CHAR		'\x04'
+#define MONOSPACE_STR		"\x11"
+#define MONOSPACE_CHAR		'\x11'
+#define STRIKE_STR			"\x1E"
+#define STRIKE_CHAR			'\x1E'
 
 #ifndef __GNUC__
 # define __attribute__(X)
@@ -5,6 +5,8 @@
 #include "xml_document.h"
 #include "crashcatcher.h"
 #include "context.h"
+#include "logwriter.h"
+#include "timestamp.h"
 
 const char* configname = UNIXNAME ".xml";
 
@@ -18,9 +20,14 @@ int main (int argc, char* argv[])
 	if (Config::loadFromFile (configname) == false)
 		Config::saveToFile (configname);
 
+	applyTimestampFormat();
+
+	LogWriter::startLogging();
 	(new MainWindow)->show();
 	Context::setCurrentContext (null);
-	app.exec();
+	const int result = app.exec();
+	LogWriter::stopLogging();
+	return result;
 }
 
 // =============================================================================
@@ -9,12 +9,12 @@
 #include "config.h"
 #include "commands.h"
 #include "user.h"
+#include "userlistmodel.h"
 
 #define CALIBRATE_ACTION(NAME) \
 	connect (ui->action##NAME, SIGNAL (triggered()), this, SLOT (action##NAME()));
 
 MainWindow* win = null;
-QTextDocument g_defaultDocument;
 
 CONFIG (String,		quicklaunch_nick,		"")
 CONFIG (String,		quicklaunch_server,		"")
@@ -155,8 +155,8 @@ void MainWindow::updateOutputWidget()
 {
 	Context* context = Context::currentContext();
 	ui->m_output->setEnabled (context != null);
-	ui->m_output->setDocument (context ? context->document : &g_defaultDocument);
 	ui->m_output->setFont (cfg::output_font);
+	ui->m_output->setContext (context);
 }
 
 // =============================================================================
@@ -235,21 +235,21 @@ void MainWindow::inputEnterPressed() // [slot]
 	{
 		case CTX_Server:
 		{
-			conn->write (input + "\n");
+			conn->write (input + "\n", SendPriority_High);
 			context->print (input);
 			break;
 		}
 
 		case CTX_Channel:
 		{
-			conn->write (format ("PRIVMSG %1 :%2\n", context->target.chan->name, input));
+			conn->write (format ("PRIVMSG %1 :%2\n", context->target.chan->name, input), SendPriority_High);
 			context->writeIRCMessage (conn->ourselves->nickname, input);
 			break;
 		}
 
 		case CTX_Query:
 		{
-			conn->write (format ("PRIVMSG %1 :%2\n", context->target.user->nickname, input));
+			conn->write (format ("PRIVMSG %1 :%2\n", context->target.user->nickname, input), SendPriority_High);
 			context->writeIRCMessage (conn->ourselves->nickname, input);
 			break;
 		}
@@ -260,38 +260,22 @@ void MainWindow::inputEnterPressed() // [slot]
 //
 void MainWindow::updateUserlist()
 {
-	IRCChannel* senderChan = qobject_cast<IRCChannel*> (sender());
 	Context* ctx = Context::currentContext();
-	IRCChannel* currentChan = (ctx->type == CTX_Channel) ? ctx->target.chan : null;
+	IRCChannel* chan = (ctx != null && ctx->type == CTX_Channel) ? ctx->target.chan : null;
+	UserlistModel* oldModel = qobject_cast<UserlistModel*> (ui->m_userlist->model());
+	UserlistModel* newModel = (chan != null) ? chan->userlistModel : null;
 
-	// If this is triggered by a channel through a connection, only update if the
-	// channel is the one we have selected right now.
-	if (senderChan != null && currentChan != senderChan)
+	if (oldModel == newModel)
 		return;
 
-	ui->m_userlist->clear();
+	// Only the displayed model keeps itself up to date.
+	if (oldModel != null)
+		oldModel->setDisplayed (false);
 
-	// If we're not in a channel, don't re-populate it.
-	if (currentChan == null)
-		return;
-
-	auto sortFunction =
-		[currentChan] (const UserlistEntry& a, const UserlistEntry& b) -> bool
-		{
-			EStatus statusA = a.userInfo->getStatusInChannel (currentChan);
-			EStatus statusB = b.userInfo->getStatusInChannel (currentChan);
-
-			if (statusA != statusB)
-				return statusA > statusB;
-
-			return a.userInfo->nickname.localeAwareCompare (b.userInfo->nickname) > 0;
-		};
-
-	QList<UserlistEntry> users = currentChan->userlist;
-	std::sort (users.begin(), users.end(), sortFunction);
+	if (newModel != null)
+		newModel->setDisplayed (true);
 
-	for (const UserlistEntry& e : users)
-		ui->m_userlist->addItem (e.userInfo->nickname);
+	ui->m_userlist->setModel (newModel);
 }
 
 enum EntryListType
@@ -0,0 +1,369 @@
+#include "message.h"
+#include "misc.h"
+
+// =============================================================================
+//
+IRCMessage::IRCMessage() :
+	m_paramCount (0),
+	m_commandId (Command_Unknown),
+	m_numeric (-1),
+	m_hasTrailing (false)
+{
+	m_tags.start = m_tags.length = 0;
+	m_prefix.start = m_prefix.length = 0;
+	m_nick = m_user = m_host = m_prefix;
+	m_command.start = m_command.length = 0;
+}
+
+// =============================================================================
+//
+// Packs a command name of up to 8 characters into an integer key, one byte per
+// character, so that command names can be switched on.
+//
+static constexpr quint64 packCommand (const char* name, int i = 0)
+{
+	return (name[i] == '\0' || i == 8) ? 0 :
+		(quint64 (uchar (name[i])) << (i * 8)) | packCommand (name, i + 1);
+}
+
+// =============================================================================
+//
+// Interns the command name of @length characters at @data. Lowercase letters are
+// folded to uppercase while packing since commands are case-insensitive.
+//
+static ECommand internCommand (const QChar* data, int length)
+{
+	if (length > 8)
+		return Command_Unknown;
+
+	quint64 key = 0;
+
+	for (int i = 0; i < length; ++i)
+	{
+		ushort c = data[i].unicode();
+
+		if (c >= 'a' && c <= 'z')
+			c -= 'a' - 'A';
+		elif (c >= 0x80)
+			return Command_Unknown;
+
+		key |= quint64 (c) << (i * 8);
+	}
+
+	switch (key)
+	{
+		case packCommand ("AWAY"):		return Command_Away;
+		case packCommand ("BATCH"):		return Command_Batch;
+		case packCommand ("CAP"):		return Command_Cap;
+		case packCommand ("ERROR"):		return Command_Error;
+		case packCommand ("INVITE"):	return Command_Invite;
+		case packCommand ("JOIN"):		return Command_Join;
+		case packCommand ("KICK"):		return Command_Kick;
+		case packCommand ("MODE"):		return Command_Mode;
+		case packCommand ("NICK"):		return Command_Nick;
+		case packCommand ("NOTICE"):	return Command_Notice;
+		case packCommand ("PART"):		return Command_Part;
+		case packCommand ("PING"):		return Command_Ping;
+		case packCommand ("PONG"):		return Command_Pong;
+		case packCommand ("PRIVMSG"):	return Command_Privmsg;
+		case packCommand ("QUIT"):		return Command_Quit;
+		case packCommand ("TOPIC"):		return Command_Topic;
+	}
+
+	return Command_Unknown;
+}
+
+// =============================================================================
+//
+// Splits the @prefix span of @data into the nick, user and host spans. If the
+// prefix is not a full nick!user@host mask, all of it goes into @nick and the
+// user and host spans are left empty.
+//
+static void splitPrefixSpans (const QChar* data, const IRCMessage::Span& prefix,
+	IRCMessage::Span& nick, IRCMessage::Span& user, IRCMessage::Span& host)
+{
+	const int end = prefix.start + prefix.length;
+	int bang = prefix.start;
+	int at;
+
+	nick = prefix;
+	user.start = host.start = end;
+	user.length = host.length = 0;
+
+	while (bang < end && data[bang] != '!')
+		bang++;
+
+	for (at = bang + 1; at < end; ++at)
+	{
+		if (data[at] == '@')
+			break;
+	}
+
+	// Each part must be non-empty for this to be a user mask.
+	if (bang == prefix.start || at >= end - 1 || at == bang + 1)
+		return;
+
+	nick.length = bang - prefix.start;
+	user.start = bang + 1;
+	user.length = at - user.start;
+	host.start = at + 1;
+	host.length = end - host.start;
+}
+
+// =============================================================================
+//
+// Parses @line into this message. Returns false if the line has no command and
+// is thus illegible.
+//
+bool IRCMessage::parse (const QString& line)
+{
+	m_raw = line;
+	m_tags.start = m_tags.length = 0;
+	m_prefix.start = m_prefix.length = 0;
+	m_paramCount = 0;
+	m_commandId = Command_Unknown;
+	m_numeric = -1;
+	m_hasTrailing = false;
+
+	const QChar* data = m_raw.constData();
+	const int length = m_raw.length();
+	int i = 0;
+
+	// Reads a space-delimited word starting at i into @span and skips any
+	// spaces after it.
+	auto readWord = [&] (Span& span)
+	{
+		span.start = i;
+
+		while (i < length && data[i] != ' ')
+			i++;
+
+		span.length = i - span.start;
+
+		while (i < length && data[i] == ' ')
+			i++;
+	};
+
+	if (i < length && data[i] == '@')
+	{
+		i++;
+		readWord (m_tags);
+	}
+
+	if (i < length && data[i] == ':')
+	{
+		i++;
+		readWord (m_prefix);
+	}
+
+	splitPrefixSpans (data, m_prefix, m_nick, m_user, m_host);
+
+	readWord (m_command);
+
+	if (m_command.length == 0)
+		return false;
+
+	while (i < length)
+	{
+		Span& span = m_params[m_paramCount++];
+
+		if (data[i] == ':' || m_paramCount == MaxParams)
+		{
+			// The trailing parameter extends to the end of the line, spaces and
+			// all. The last parameter slot is treated the same way so that
+			// nothing is lost.
+			if (data[i] == ':')
+			{
+				m_hasTrailing = true;
+				i++;
+			}
+
+			span.start = i;
+			span.length = length - i;
+			break;
+		}
+
+		readWord (span);
+	}
+
+	// Numeric replies are always exactly three digits.
+	if (m_command.length == 3)
+	{
+		const QChar* c = data + m_command.start;
+
+		if (isWithinRange<ushort> (c[0].unicode(), '0', '9')
+			&& isWithinRange<ushort> (c[1].unicode(), '0', '9')
+			&& isWithinRange<ushort> (c[2].unicode(), '0', '9'))
+		{
+			m_numeric = ((c[0].unicode() - '0') * 100) + ((c[1].unicode() - '0') * 10)
+				+ (c[2].unicode() - '0');
+			m_commandId = Command_Numeric;
+		}
+	}
+
+	if (m_numeric == -1)
+		m_commandId = internCommand (data + m_command.start, m_command.length);
+
+	return true;
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::reference (const Span& span) const
+{
+	return QStringRef (&m_raw, span.start, span.length);
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::tags() const
+{
+	return reference (m_tags);
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::prefix() const
+{
+	return reference (m_prefix);
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::nick() const
+{
+	return reference (m_nick);
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::user() const
+{
+	return reference (m_user);
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::host() const
+{
+	return reference (m_host);
+}
+
+// =============================================================================
+//
+// Splits a nick!user@host mask into its parts. Returns false if @prefix is not
+// a user mask, in which case @nick is the whole prefix. This does not touch any
+// shared state and is safe to call from any thread.
+//
+bool IRCMessage::splitPrefix (const QStringRef& prefix, QStringRef& nick,
+	QStringRef& user, QStringRef& host) // [static]
+{
+	Span span, nickSpan, userSpan, hostSpan;
+	span.start = 0;
+	span.length = prefix.length();
+	splitPrefixSpans (prefix.unicode(), span, nickSpan, userSpan, hostSpan);
+
+	const QString* string = prefix.string();
+	const int offset = prefix.position();
+	nick = QStringRef (string, offset + nickSpan.start, nickSpan.length);
+	user = QStringRef (string, offset + userSpan.start, userSpan.length);
+	host = QStringRef (string, offset + hostSpan.start, hostSpan.length);
+	return userSpan.length > 0;
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::command() const
+{
+	return reference (m_command);
+}
+
+// =============================================================================
+//
+int IRCMessage::paramCount() const
+{
+	return m_paramCount;
+}
+
+// =============================================================================
+//
+// Returns the @i'th parameter, or an empty reference if there is no such
+// parameter.
+//
+QStringRef IRCMessage::param (int i) const
+{
+	if (i < 0 || i >= m_paramCount)
+		return QStringRef();
+
+	return reference (m_params[i]);
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::lastParam() const
+{
+	return param (m_paramCount - 1);
+}
+
+// =============================================================================
+//
+QStringRef IRCMessage::trailing() const
+{
+	if (m_hasTrailing == false)
+		return QStringRef();
+
+	return lastParam();
+}
+
+// =============================================================================
+//
+// Returns the parameters from the @i'th one onwards, joined with spaces, e.g.
+// "+ov alice bob" of a MODE message.
+//
+QString IRCMessage::paramsFrom (int i) const
+{
+	QString out;
+
+	for (; i < m_paramCount; ++i)
+	{
+		if (!out.isEmpty())
+			out += " ";
+
+		out += reference (m_params[i]);
+	}
+
+	return out;
+}
+
+// =============================================================================
+//
+// Finds the value of message tag @key. Returns an empty reference if the tag
+// is not present or has no value.
+//
+QStringRef IRCMessage::tag (const QString& key) const
+{
+	const QChar* data = m_raw.constData();
+	const int end = m_tags.start + m_tags.length;
+	int i = m_tags.start;
+
+	while (i < end)
+	{
+		int j = i;
+
+		while (j < end && data[j] != ';')
+			j++;
+
+		// i..j is now one key[=value] pair
+		if (j - i >= key.length()
+			&& QStringRef (&m_raw, i, key.length()) == key
+			&& (i + key.length() == j || data[i + key.length()] == '='))
+		{
+			const int valueStart = qMin (i + key.length() + 1, j);
+			return QStringRef (&m_raw, valueStart, j - valueStart);
+		}
+
+		i = j + 1;
+	}
+
+	return QStringRef();
+}
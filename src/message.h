@@ -0,0 +1,126 @@
+#ifndef SPEECHBUBBLE_MESSAGE_H
+#define SPEECHBUBBLE_MESSAGE_H
+
+#include "main.h"
+
+// =============================================================================
+//
+// Interned IDs of named IRC commands. Numeric replies are identified by their
+// reply code instead, see IRCMessage::numeric().
+//
+enum ECommand
+{
+	Command_Unknown,
+	Command_Numeric,
+	Command_Away,
+	Command_Batch,
+	Command_Cap,
+	Command_Error,
+	Command_Invite,
+	Command_Join,
+	Command_Kick,
+	Command_Mode,
+	Command_Nick,
+	Command_Notice,
+	Command_Part,
+	Command_Ping,
+	Command_Pong,
+	Command_Privmsg,
+	Command_Quit,
+	Command_Topic,
+
+	Command_NumCommands
+};
+
+// =============================================================================
+//
+// A single line from the IRC server, parsed once into its parts. The parts are
+// stored as offsets into the raw line and are returned as string references, so
+// nothing is copied until a handler actually needs a QString.
+//
+//     [@tags] [:prefix] command [param ...] [:trailing]
+//
+// If the prefix is a user mask (nick!user@host) it is split into its parts as
+// well. Server prefixes are available through both prefix() and nick().
+//
+class IRCMessage
+{
+public:
+	enum
+	{
+		MaxParams = 15,
+	};
+
+	struct Span
+	{
+		int start;
+		int length;
+	};
+
+	IRCMessage();
+
+	bool				parse (const QString& line);
+	int					paramCount() const;
+	QStringRef			command() const;
+	QStringRef			host() const;
+	QStringRef			lastParam() const;
+	QStringRef			nick() const;
+	QStringRef			param (int i) const;
+	QString				paramsFrom (int i) const;
+	QStringRef			prefix() const;
+	QStringRef			tag (const QString& key) const;
+	QStringRef			tags() const;
+	QStringRef			trailing() const;
+	QStringRef			user() const;
+
+	static bool			splitPrefix (const QStringRef& prefix, QStringRef& nick,
+							QStringRef& user, QStringRef& host);
+
+	inline ECommand commandId() const
+	{
+		return m_commandId;
+	}
+
+	inline bool hasTrailing() const
+	{
+		return m_hasTrailing;
+	}
+
+	inline bool hasUserPrefix() const
+	{
+		return m_user.length > 0;
+	}
+
+	inline bool isNumeric() const
+	{
+		return m_numeric != -1;
+	}
+
+	inline int numeric() const
+	{
+		return m_numeric;
+	}
+
+	inline const QString& raw() const
+	{
+		return m_raw;
+	}
+
+private:
+	QStringRef			reference (const Span& span) const;
+
+	QString				m_raw;
+	Span				m_tags;
+	Span				m_prefix;
+	Span				m_nick;
+	Span				m_user;
+	Span				m_host;
+	Span				m_command;
+	Span				m_params[MaxParams];
+	int					m_paramCount;
+	ECommand			m_commandId;
+	int					m_numeric;
+	bool				m_hasTrailing;
+};
+
+#endif // SPEECHBUBBLE_MESSAGE_H
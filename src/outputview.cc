@@ -0,0 +1,405 @@
+#include <QAction>
+#include <QApplication>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <qmath.h>
+#include "outputview.h"
+#include "context.h"
+
+// Space between the text and the edges of the viewport.
+static const int g_margin = 4;
+
+// =============================================================================
+//
+static bool isBefore (const OutputView::Position& a, const OutputView::Position& b)
+{
+	return (a.line < b.line) || (a.line == b.line && a.column < b.column);
+}
+
+// =============================================================================
+//
+OutputView::OutputView (QWidget* parent) :
+	QAbstractScrollArea (parent),
+	m_context (null),
+	m_bottomLine (0),
+	m_isFollowing (true),
+	m_isSelecting (false)
+{
+	m_selectionStart.line = m_selectionEnd.line = 0;
+	m_selectionStart.column = m_selectionEnd.column = 0;
+	setHorizontalScrollBarPolicy (Qt::ScrollBarAlwaysOff);
+	viewport()->setCursor (Qt::IBeamCursor);
+
+	QAction* copyAction = new QAction (tr ("Copy"), this);
+	copyAction->setShortcut (QKeySequence::Copy);
+	copyAction->setShortcutContext (Qt::WidgetWithChildrenShortcut);
+	addAction (copyAction);
+	setContextMenuPolicy (Qt::ActionsContextMenu);
+
+	connect (copyAction, SIGNAL (triggered()), this, SLOT (copyToClipboard()));
+	connect (verticalScrollBar(), SIGNAL (valueChanged (int)), this, SLOT (scrolled (int)));
+}
+
+// =============================================================================
+//
+OutputView::~OutputView()
+{
+	clearLayouts();
+}
+
+// =============================================================================
+//
+void OutputView::setContext (Context* context)
+{
+	if (m_context != null)
+		disconnect (m_context, null, this, null);
+
+	clearLayouts();
+	m_context = context;
+	m_isFollowing = true;
+	m_isSelecting = false;
+	m_selectionStart.line = m_selectionEnd.line = 0;
+	m_selectionStart.column = m_selectionEnd.column = 0;
+
+	if (m_context != null)
+		connect (m_context, SIGNAL (linesChanged()), this, SLOT (linesChanged()));
+
+	updateScrollBar();
+	viewport()->update();
+}
+
+// =============================================================================
+//
+void OutputView::clearLayouts()
+{
+	for (QTextLayout* layout : m_layouts)
+		delete layout;
+
+	m_layouts.clear();
+	m_visibleLines.clear();
+}
+
+// =============================================================================
+//
+// Gets the layout of @line, laying it out to the width of the viewport if it
+// is not within the viewport already.
+//
+QTextLayout* OutputView::layoutFor (qint64 line)
+{
+	auto it = m_layouts.find (line);
+
+	if (it != m_layouts.end())
+		return it.value();
+
+	QString text;
+	QList<QTextLayout::FormatRange> formats;
+	Context::formatLine (m_context->lines[line - m_context->firstLineNumber], text, formats);
+
+	QTextOption option;
+	option.setWrapMode (QTextOption::WrapAtWordBoundaryOrAnywhere);
+
+	QTextLayout* layout = new QTextLayout (text, font());
+	layout->setTextOption (option);
+	layout->setAdditionalFormats (formats);
+	layout->setCacheEnabled (true);
+
+	const qreal width = qMax (viewport()->width() - 2 * g_margin, 1);
+	qreal height = 0;
+	layout->beginLayout();
+
+	for (QTextLine textLine = layout->createLine(); textLine.isValid();
+		textLine = layout->createLine())
+	{
+		textLine.setLineWidth (width);
+		textLine.setPosition (QPointF (0, height));
+		height += textLine.height();
+	}
+
+	layout->endLayout();
+	m_layouts.insert (line, layout);
+	return layout;
+}
+
+// =============================================================================
+//
+// Updates the range of the scroll bar to match the lines of the context. The
+// bottom line is kept where it is unless the view is following new lines.
+//
+void OutputView::updateScrollBar()
+{
+	const qint64 first = (m_context != null) ? m_context->firstLineNumber : 0;
+	const int count = (m_context != null) ? m_context->lines.size() : 0;
+
+	if (m_isFollowing || m_bottomLine >= first + count)
+		m_bottomLine = first + count - 1;
+
+	if (m_bottomLine < first)
+		m_bottomLine = first;
+
+	QScrollBar* bar = verticalScrollBar();
+	bar->blockSignals (true);
+	bar->setRange (0, qMax (count - 1, 0));
+	bar->setValue (m_bottomLine - first);
+	bar->setPageStep (qMax (viewport()->height() / fontMetrics().lineSpacing(), 1));
+	bar->blockSignals (false);
+}
+
+// =============================================================================
+//
+void OutputView::scrolled (int value) // [slot]
+{
+	const qint64 first = (m_context != null) ? m_context->firstLineNumber : 0;
+	m_bottomLine = first + value;
+	m_isFollowing = (value == verticalScrollBar()->maximum());
+	viewport()->update();
+}
+
+// =============================================================================
+//
+void OutputView::linesChanged() // [slot]
+{
+	updateScrollBar();
+	viewport()->update();
+}
+
+// =============================================================================
+//
+// Draws the lines from the bottom line upwards until the viewport is full.
+// Layouts of lines which are no longer within the viewport are dropped.
+//
+void OutputView::paintEvent (QPaintEvent*)
+{
+	QPainter painter (viewport());
+	m_visibleLines.clear();
+
+	if (m_context == null || m_context->lines.isEmpty())
+	{
+		clearLayouts();
+		return;
+	}
+
+	Position start = m_selectionStart;
+	Position end = m_selectionEnd;
+
+	if (isBefore (end, start))
+		qSwap (start, end);
+
+	QTextCharFormat selectionFormat;
+	selectionFormat.setBackground (palette().highlight());
+	selectionFormat.setForeground (palette().highlightedText());
+
+	const qint64 first = m_context->firstLineNumber;
+	qint64 line = m_bottomLine;
+	int y = viewport()->height();
+
+	for (; line >= first && y > 0; --line)
+	{
+		QTextLayout* layout = layoutFor (line);
+		y -= qCeil (layout->boundingRect().height());
+
+		VisibleLine visible;
+		visible.line = line;
+		visible.top = y;
+		visible.layout = layout;
+		m_visibleLines.prepend (visible);
+
+		QVector<QTextLayout::FormatRange> selections;
+
+		if (hasSelection() && line >= start.line && line <= end.line)
+		{
+			QTextLayout::FormatRange range;
+			range.start = (line == start.line) ? start.column : 0;
+			range.length = ((line == end.line) ? end.column : layout->text().size()) - range.start;
+			range.format = selectionFormat;
+			selections << range;
+		}
+
+		layout->draw (&painter, QPointF (g_margin, y), selections);
+	}
+
+	for (auto it = m_layouts.begin(); it != m_layouts.end();)
+	{
+		if (it.key() <= line || it.key() > m_bottomLine)
+		{
+			delete it.value();
+			it = m_layouts.erase (it);
+		}
+		else
+			++it;
+	}
+}
+
+// =============================================================================
+//
+// Finds the scrollback position at @point in the viewport. Points above or
+// below the lines snap to the nearest line. Returns false if no lines are
+// visible.
+//
+bool OutputView::findPosition (const QPoint& point, Position& position) const
+{
+	if (m_visibleLines.isEmpty())
+		return false;
+
+	for (const VisibleLine& visible : m_visibleLines)
+	{
+		const QTextLayout* layout = visible.layout;
+		const qreal y = point.y() - visible.top;
+
+		if (y >= layout->boundingRect().height() && &visible != &m_visibleLines.last())
+			continue;
+
+		position.line = visible.line;
+
+		if (y < 0)
+		{
+			position.column = 0;
+			return true;
+		}
+
+		for (int i = 0; i < layout->lineCount(); ++i)
+		{
+			const QTextLine textLine = layout->lineAt (i);
+
+			if (y < textLine.y() + textLine.height() || i == layout->lineCount() - 1)
+			{
+				position.column = textLine.xToCursor (point.x() - g_margin);
+				return true;
+			}
+		}
+
+		position.column = 0;
+		return true;
+	}
+
+	return false;
+}
+
+// =============================================================================
+//
+void OutputView::mousePressEvent (QMouseEvent* ev)
+{
+	Position position;
+
+	if (ev->button() == Qt::LeftButton && findPosition (ev->pos(), position))
+	{
+		m_selectionStart = m_selectionEnd = position;
+		m_isSelecting = true;
+		viewport()->update();
+	}
+
+	QAbstractScrollArea::mousePressEvent (ev);
+}
+
+// =============================================================================
+//
+void OutputView::mouseMoveEvent (QMouseEvent* ev)
+{
+	Position position;
+
+	if (m_isSelecting && findPosition (ev->pos(), position))
+	{
+		m_selectionEnd = position;
+		viewport()->update();
+	}
+
+	QAbstractScrollArea::mouseMoveEvent (ev);
+}
+
+// =============================================================================
+//
+void OutputView::mouseReleaseEvent (QMouseEvent* ev)
+{
+	if (ev->button() == Qt::LeftButton && m_isSelecting)
+	{
+		m_isSelecting = false;
+
+		if (hasSelection() && QApplication::clipboard()->supportsSelection())
+			copySelection (QClipboard::Selection);
+	}
+
+	QAbstractScrollArea::mouseReleaseEvent (ev);
+}
+
+// =============================================================================
+//
+void OutputView::changeEvent (QEvent* ev)
+{
+	if (ev->type() == QEvent::FontChange)
+	{
+		clearLayouts();
+		updateScrollBar();
+		viewport()->update();
+	}
+
+	QAbstractScrollArea::changeEvent (ev);
+}
+
+// =============================================================================
+//
+void OutputView::resizeEvent (QResizeEvent* ev)
+{
+	// The lines need to be wrapped again.
+	if (ev->size().width() != ev->oldSize().width())
+		clearLayouts();
+
+	QAbstractScrollArea::resizeEvent (ev);
+	updateScrollBar();
+}
+
+// =============================================================================
+//
+bool OutputView::hasSelection() const
+{
+	return m_context != null
+		&& (m_selectionStart.line != m_selectionEnd.line
+		|| m_selectionStart.column != m_selectionEnd.column);
+}
+
+// =============================================================================
+//
+// Returns the selected text as plain text, one line per scrollback line. Lines
+// evicted from the scrollback since they were selected are left out.
+//
+QString OutputView::selectedText() const
+{
+	if (hasSelection() == false)
+		return "";
+
+	Position start = m_selectionStart;
+	Position end = m_selectionEnd;
+
+	if (isBefore (end, start))
+		qSwap (start, end);
+
+	const qint64 first = m_context->firstLineNumber;
+	QStringList result;
+
+	for (qint64 line = qMax (start.line, first); line <= end.line; ++line)
+	{
+		QString text;
+		QList<QTextLayout::FormatRange> formats;
+		Context::formatLine (m_context->lines[line - first], text, formats);
+
+		const int from = (line == start.line) ? start.column : 0;
+		const int to = (line == end.line) ? end.column : text.size();
+		result << text.mid (from, to - from);
+	}
+
+	return result.join ("\n");
+}
+
+// =============================================================================
+//
+void OutputView::copySelection (QClipboard::Mode mode)
+{
+	if (hasSelection())
+		QApplication::clipboard()->setText (selectedText(), mode);
+}
+
+// =============================================================================
+//
+void OutputView::copyToClipboard() // [slot]
+{
+	copySelection (QClipboard::Clipboard);
+}
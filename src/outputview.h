@@ -0,0 +1,80 @@
+#ifndef SPEECHBUBBLE_OUTPUTVIEW_H
+#define SPEECHBUBBLE_OUTPUTVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QClipboard>
+#include <QMap>
+#include <QTextLayout>
+#include "main.h"
+
+class Context;
+
+// =============================================================================
+//
+// Displays the scrollback of a context. Only the lines within the viewport are
+// laid out, straight from the line records of the context, so the cost of the
+// view does not depend on how long the scrollback is.
+//
+// The scroll bar is counted in lines; its value is the number of the line shown
+// at the bottom of the viewport. While it is at its maximum, the view follows
+// new lines as they are printed.
+//
+class OutputView : public QAbstractScrollArea
+{
+	Q_OBJECT
+
+public:
+	// A position in the scrollback: a line number of the context and a
+	// character index into the displayed text of that line.
+	struct Position
+	{
+		qint64	line;
+		int		column;
+	};
+
+	explicit OutputView (QWidget* parent = null);
+	~OutputView();
+
+	void			copySelection (QClipboard::Mode mode = QClipboard::Clipboard);
+	bool			hasSelection() const;
+	QString			selectedText() const;
+	void			setContext (Context* context);
+
+protected:
+	void			changeEvent (QEvent* ev) override;
+	void			mouseMoveEvent (QMouseEvent* ev) override;
+	void			mousePressEvent (QMouseEvent* ev) override;
+	void			mouseReleaseEvent (QMouseEvent* ev) override;
+	void			paintEvent (QPaintEvent* ev) override;
+	void			resizeEvent (QResizeEvent* ev) override;
+
+private slots:
+	void			copyToClipboard();
+	void			linesChanged();
+	void			scrolled (int value);
+
+private:
+	// A line within the viewport as of the last paint.
+	struct VisibleLine
+	{
+		qint64			line;
+		int				top;
+		QTextLayout*	layout;
+	};
+
+	void			clearLayouts();
+	bool			findPosition (const QPoint& point, Position& position) const;
+	QTextLayout*	layoutFor (qint64 line);
+	void			updateScrollBar();
+
+	Context*					m_context;
+	QMap<qint64, QTextLayout*>	m_layouts;
+	QList<VisibleLine>			m_visibleLines;
+	qint64						m_bottomLine;
+	bool						m_isFollowing;
+	bool						m_isSelecting;
+	Position					m_selectionStart;
+	Position					m_selectionEnd;
+};
+
+#endif // SPEECHBUBBLE_OUTPUTVIEW_H
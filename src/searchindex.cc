@@ -0,0 +1,879 @@
+#include <cstring>
+#include <climits>
+#include <QDir>
+#include <QFileInfo>
+#include <QtEndian>
+#include "searchindex.h"
+
+enum
+{
+	RunMagic			= 0x52534253,	// "SBSR"
+	RunVersion			= 1,
+	RunHeaderSize		= 40,
+	LineEntrySize		= 16,
+	DictionaryEntrySize	= 16,
+	FlushLines			= 65536,		// lines in memory before they are written into a run
+	MergeFactor			= 8,			// runs of a level which are merged into one
+	MinimumWordLength	= 2,
+	MaximumWordLength	= 64,
+};
+
+// A term of a run being written.
+struct DictionaryEntry
+{
+	quint32		termOffset;
+	quint32		termLength;
+	quint32		firstPosting;
+	quint32		postingCount;
+};
+
+// The postings of a term, either in memory or in a run file.
+struct PostingList
+{
+	const quint32*	native = null;
+	const uchar*	encoded = null;
+	qint64			count = 0;
+
+	quint32 at (qint64 i) const
+	{
+		return (native != null) ? native[i] : qFromLittleEndian<quint32> (encoded + (i * 4));
+	}
+};
+
+// =============================================================================
+//
+// Orders terms by their bytes. Run dictionaries are sorted in this order.
+//
+static int compareTerms (const uchar* a, int aLength, const uchar* b, int bLength)
+{
+	const int result = memcmp (a, b, qMin (aLength, bLength));
+	return (result != 0) ? result : aLength - bLength;
+}
+
+// =============================================================================
+//
+static bool isTermLessThan (const QByteArray& a, const QByteArray& b)
+{
+	return compareTerms (reinterpret_cast<const uchar*> (a.constData()), a.size(),
+		reinterpret_cast<const uchar*> (b.constData()), b.size()) < 0;
+}
+
+// =============================================================================
+//
+static bool isHexDigit (QChar c)
+{
+	return c.isDigit()
+		|| (c.unicode() >= 'a' && c.unicode() <= 'f')
+		|| (c.unicode() >= 'A' && c.unicode() <= 'F');
+}
+
+// =============================================================================
+//
+static void appendInteger (QByteArray& out, quint32 value)
+{
+	uchar buffer[4];
+	qToLittleEndian<quint32> (value, buffer);
+	out.append (reinterpret_cast<const char*> (buffer), sizeof buffer);
+}
+
+// =============================================================================
+//
+static void appendLineLocation (QByteArray& out, const SearchIndex::LineLocation& line)
+{
+	uchar buffer[LineEntrySize];
+	qToLittleEndian<quint32> (line.logId, buffer);
+	qToLittleEndian<quint32> (line.offset, buffer + 4);
+	qToLittleEndian<qint64> (line.segmentStart, buffer + 8);
+	out.append (reinterpret_cast<const char*> (buffer), sizeof buffer);
+}
+
+// =============================================================================
+//
+static SearchIndex::LineLocation lineOfRun (const SearchIndex::Run& run, quint32 line)
+{
+	const uchar* entry = run.data + RunHeaderSize + (qint64 (line) * LineEntrySize);
+	SearchIndex::LineLocation location;
+	location.logId = qFromLittleEndian<quint32> (entry);
+	location.offset = qFromLittleEndian<quint32> (entry + 4);
+	location.segmentStart = qFromLittleEndian<qint64> (entry + 8);
+	return location;
+}
+
+// =============================================================================
+//
+static const uchar* dictionaryEntry (const SearchIndex::Run& run, qint64 i)
+{
+	return run.data + run.dictionaryOffset + (i * DictionaryEntrySize);
+}
+
+// =============================================================================
+//
+static const uchar* termOfEntry (const SearchIndex::Run& run, const uchar* entry)
+{
+	return run.data + run.termsOffset + qFromLittleEndian<quint32> (entry);
+}
+
+// =============================================================================
+//
+static PostingList postingsOfEntry (const SearchIndex::Run& run, const uchar* entry)
+{
+	PostingList list;
+	list.encoded = run.data + run.postingsOffset + (qint64 (qFromLittleEndian<quint32> (entry + 8)) * 4);
+	list.count = qFromLittleEndian<quint32> (entry + 12);
+	return list;
+}
+
+// =============================================================================
+//
+// Looks up the postings of each of @keys in @run. Returns false if some key is
+// not in the run at all.
+//
+static bool findPostings (const SearchIndex::Run& run, const QList<QByteArray>& keys,
+	QVector<PostingList>& lists)
+{
+	for (const QByteArray& key : keys)
+	{
+		qint64 low = 0;
+		qint64 high = run.termCount;
+		bool found = false;
+
+		while (low < high && found == false)
+		{
+			const qint64 middle = (low + high) / 2;
+			const uchar* entry = dictionaryEntry (run, middle);
+			const int result = compareTerms (termOfEntry (run, entry),
+				qFromLittleEndian<quint32> (entry + 4),
+				reinterpret_cast<const uchar*> (key.constData()), key.size());
+
+			if (result < 0)
+				low = middle + 1;
+			elif (result > 0)
+				high = middle;
+			else
+			{
+				lists << postingsOfEntry (run, entry);
+				found = true;
+			}
+		}
+
+		if (found == false)
+			return false;
+	}
+
+	return true;
+}
+
+// =============================================================================
+//
+// Returns the amount of postings among the first @end ones of @list which are
+// not greater than @target.
+//
+static qint64 countAtMost (const PostingList& list, qint64 end, quint32 target)
+{
+	qint64 low = 0;
+
+	while (low < end)
+	{
+		const qint64 middle = (low + end) / 2;
+
+		if (list.at (middle) <= target)
+			low = middle + 1;
+		else
+			end = middle;
+	}
+
+	return low;
+}
+
+// =============================================================================
+//
+// Finds the lines which are in all of @lists, newest first, and passes them to
+// @accept until it returns false.
+//
+template<typename Function>
+static void intersect (const QVector<PostingList>& lists, Function accept)
+{
+	QVector<qint64> ends;
+
+	for (const PostingList& list : lists)
+		ends << list.count;
+
+	forever
+	{
+		// No line newer than the oldest of the newest remaining postings can be
+		// in all of the lists.
+		quint32 target = UINT_MAX;
+
+		for (int i = 0; i < lists.size(); ++i)
+		{
+			if (ends[i] == 0)
+				return;
+
+			target = qMin (target, lists[i].at (ends[i] - 1));
+		}
+
+		bool isMatch = true;
+
+		for (int i = 0; i < lists.size(); ++i)
+		{
+			ends[i] = countAtMost (lists[i], ends[i], target);
+
+			if (ends[i] == 0 || lists[i].at (ends[i] - 1) != target)
+				isMatch = false;
+		}
+
+		if (isMatch)
+		{
+			if (accept (target) == false)
+				return;
+
+			for (qint64& end : ends)
+				end--;
+		}
+	}
+}
+
+// =============================================================================
+//
+static void writeRunHeader (QFile& file, const SearchIndex::Run& run)
+{
+	uchar buffer[RunHeaderSize];
+	qToLittleEndian<quint32> (RunMagic, buffer);
+	qToLittleEndian<quint16> (RunVersion, buffer + 4);
+	qToLittleEndian<quint16> (run.level, buffer + 6);
+	qToLittleEndian<quint32> (run.lineCount, buffer + 8);
+	qToLittleEndian<quint32> (run.termCount, buffer + 12);
+	qToLittleEndian<qint64> (run.postingsOffset, buffer + 16);
+	qToLittleEndian<qint64> (run.termsOffset, buffer + 24);
+	qToLittleEndian<qint64> (run.dictionaryOffset, buffer + 32);
+	file.seek (0);
+	file.write (reinterpret_cast<const char*> (buffer), sizeof buffer);
+}
+
+// =============================================================================
+//
+// Writes the terms and the dictionary of a run after its postings, fills in the
+// header and moves the finished file to @path.
+//
+static bool finishRun (QFile& file, SearchIndex::Run& run, const QByteArray& terms,
+	const QVector<DictionaryEntry>& dictionary, const QString& path)
+{
+	QByteArray buffer;
+
+	for (const DictionaryEntry& entry : dictionary)
+	{
+		appendInteger (buffer, entry.termOffset);
+		appendInteger (buffer, entry.termLength);
+		appendInteger (buffer, entry.firstPosting);
+		appendInteger (buffer, entry.postingCount);
+	}
+
+	run.termCount = dictionary.size();
+	run.termsOffset = file.pos();
+	run.dictionaryOffset = run.termsOffset + terms.size();
+	file.write (terms);
+	file.write (buffer);
+	writeRunHeader (file, run);
+	file.close();
+
+	if (file.error() != QFile::NoError || QFile::rename (file.fileName(), path) == false)
+	{
+		QFile::remove (file.fileName());
+		return false;
+	}
+
+	return true;
+}
+
+// =============================================================================
+//
+SearchIndex::SearchIndex (const QString& directory) :
+	m_directory (directory),
+	m_nextFlush (0) {}
+
+// =============================================================================
+//
+SearchIndex::~SearchIndex()
+{
+	for (Run& run : m_runs)
+		delete run.file;
+}
+
+// =============================================================================
+//
+// Splits @text into the terms it is found by. Formatting codes are skipped.
+//
+QStringList SearchIndex::termsOf (const QString& text) // [static]
+{
+	QStringList terms;
+	QString word;
+	const int length = text.length();
+
+	for (int i = 0; i <= length; ++i)
+	{
+		const QChar c = (i < length) ? text[i] : QChar();
+
+		if (i < length && c.isLetterOrNumber())
+		{
+			word += c.toLower();
+			continue;
+		}
+
+		if (word.length() >= MinimumWordLength && word.length() <= MaximumWordLength
+			&& terms.contains (word) == false)
+		{
+			terms << word;
+		}
+
+		word.clear();
+
+		// Skip the colors after color codes so that they don't end up in front
+		// of the next word.
+		if (c == COLOR_CHAR || c == HEXCOLOR_CHAR)
+		{
+			const int digits = (c == COLOR_CHAR) ? 2 : 6;
+			int j = i + 1;
+
+			for (int part = 0; part < 2; ++part)
+			{
+				const int start = j;
+
+				while (j < length && j - start < digits
+					&& (c == COLOR_CHAR ? text[j].isDigit() : isHexDigit (text[j])))
+				{
+					j++;
+				}
+
+				if (part == 1 || j == start || j + 1 >= length || text[j] != ',')
+					break;
+
+				j++;
+			}
+
+			i = j - 1;
+		}
+	}
+
+	return terms;
+}
+
+// =============================================================================
+//
+QString SearchIndex::nickTerm (const QString& nick) // [static]
+{
+	return "nick:" + nick.toLower();
+}
+
+// =============================================================================
+//
+QString SearchIndex::runPath (qint64 firstFlush, qint64 lastFlush) const
+{
+	return format ("%1/%2-%3.sbsr", m_directory,
+		QString ("%1").arg (firstFlush, 16, 10, QChar ('0')),
+		QString ("%1").arg (lastFlush, 16, 10, QChar ('0')));
+}
+
+// =============================================================================
+//
+// Loads the log names and the runs written by earlier sessions. Runs which a
+// merge was interrupted in the middle of replacing are removed.
+//
+void SearchIndex::load()
+{
+	QMutexLocker locker (&m_mutex);
+	QDir dir (m_directory);
+	QFile names (dir.filePath ("logs"));
+	QList<Run> runs;
+	qint64 lastCovered = -1;
+
+	if (names.open (QIODevice::ReadWrite))
+	{
+		const QByteArray data = names.readAll();
+
+		for (const QByteArray& name : data.split ('\n'))
+		{
+			if (name.isEmpty() == false)
+			{
+				m_logIds[QString::fromUtf8 (name)] = m_logNames.size();
+				m_logNames << QString::fromUtf8 (name);
+			}
+		}
+
+		// Terminate a name which was cut short so that the next one doesn't
+		// get appended to it.
+		if (data.isEmpty() == false && data.endsWith ('\n') == false)
+			names.write ("\n");
+	}
+
+	for (const QString& name : dir.entryList (QStringList ("*.tmp"), QDir::Files))
+		dir.remove (name);
+
+	for (const QString& name : dir.entryList (QStringList ("*.sbsr"), QDir::Files))
+	{
+		const QStringList range = QFileInfo (name).completeBaseName().split ('-');
+		Run run;
+
+		if (range.size() != 2)
+			continue;
+
+		run.path = dir.filePath (name);
+		run.firstFlush = range[0].toLongLong();
+		run.lastFlush = range[1].toLongLong();
+		m_nextFlush = qMax (m_nextFlush, run.lastFlush + 1);
+		runs << run;
+	}
+
+	// With the widest range first among runs which start at the same flush, any
+	// run which starts within the range of the run before it is covered by it.
+	qSort (runs.begin(), runs.end(), [] (const Run& a, const Run& b)
+	{
+		return (a.firstFlush != b.firstFlush) ? a.firstFlush < b.firstFlush
+			: a.lastFlush > b.lastFlush;
+	});
+
+	for (const Run& candidate : runs)
+	{
+		Run run;
+
+		if (candidate.firstFlush <= lastCovered)
+			QFile::remove (candidate.path);
+		elif (openRun (candidate.path, run))
+		{
+			m_runs << run;
+			lastCovered = run.lastFlush;
+		}
+		else
+			fprint (stderr, "couldn't read search index run %1\n", candidate.path);
+	}
+}
+
+// =============================================================================
+//
+// Maps the run file at @path into memory and reads its header into @run.
+//
+bool SearchIndex::openRun (const QString& path, Run& run)
+{
+	QFile* file = new QFile (path);
+	const QStringList range = QFileInfo (path).completeBaseName().split ('-');
+	const uchar* data = null;
+
+	if (range.size() == 2 && file->open (QIODevice::ReadOnly) && file->size() >= RunHeaderSize)
+		data = file->map (0, file->size());
+
+	if (data == null
+		|| qFromLittleEndian<quint32> (data) != RunMagic
+		|| qFromLittleEndian<quint16> (data + 4) != RunVersion)
+	{
+		delete file;
+		return false;
+	}
+
+	run.path = path;
+	run.file = file;
+	run.data = data;
+	run.firstFlush = range[0].toLongLong();
+	run.lastFlush = range[1].toLongLong();
+	run.level = qFromLittleEndian<quint16> (data + 6);
+	run.lineCount = qFromLittleEndian<quint32> (data + 8);
+	run.termCount = qFromLittleEndian<quint32> (data + 12);
+	run.postingsOffset = qFromLittleEndian<qint64> (data + 16);
+	run.termsOffset = qFromLittleEndian<qint64> (data + 24);
+	run.dictionaryOffset = qFromLittleEndian<qint64> (data + 32);
+
+	if (run.postingsOffset != RunHeaderSize + (qint64 (run.lineCount) * LineEntrySize)
+		|| run.termsOffset < run.postingsOffset
+		|| run.dictionaryOffset < run.termsOffset
+		|| run.dictionaryOffset + (qint64 (run.termCount) * DictionaryEntrySize) > file->size())
+	{
+		delete file;
+		return false;
+	}
+
+	return true;
+}
+
+// =============================================================================
+//
+// Returns the ID of the log @logName, registering the log if it is new. Only
+// called by the writer thread, which is the only one to register logs, so the
+// mutex is only held to add a new log to the list.
+//
+quint32 SearchIndex::logIdOf (const QString& logName)
+{
+	auto it = m_logIds.constFind (logName);
+
+	if (it != m_logIds.constEnd())
+		return it.value();
+
+	const quint32 id = m_logNames.size();
+	QFile names (m_directory + "/logs");
+
+	if (QDir().mkpath (m_directory) == false
+		|| names.open (QIODevice::WriteOnly | QIODevice::Append) == false)
+	{
+		fprint (stderr, "couldn't register %1 in the search index\n", logName);
+	}
+	else
+		names.write (logName.toUtf8() + "\n");
+
+	QMutexLocker locker (&m_mutex);
+	m_logNames << logName;
+	m_logIds[logName] = id;
+	return id;
+}
+
+// =============================================================================
+//
+// Indexes the line @text which was written at @offset of the segment starting
+// at @segmentStart of log @logName. @nick is who said it, if anyone.
+//
+void SearchIndex::addLine (const QString& logName, qint64 segmentStart, qint64 offset,
+	const QString& nick, const QByteArray& text)
+{
+	QStringList terms = termsOf (QString::fromUtf8 (text));
+
+	if (nick.isEmpty() == false)
+		terms << nickTerm (nick);
+
+	if (terms.isEmpty())
+		return;
+
+	LineLocation location;
+	location.logId = logIdOf (logName);
+	QMutexLocker locker (&m_mutex);
+	location.offset = offset;
+	location.segmentStart = segmentStart;
+	const quint32 line = m_memoryLines.size();
+	m_memoryLines << location;
+
+	for (const QString& term : terms)
+		m_memoryPostings[term.toUtf8()] << line;
+}
+
+// =============================================================================
+//
+// Returns whether the run in memory should be flushed. Only called by the
+// writer thread, which is the only one to add lines.
+//
+bool SearchIndex::isFull() const
+{
+	return m_memoryLines.size() >= FlushLines;
+}
+
+// =============================================================================
+//
+// Writes the run in memory into a run file. The mutex is only held to take the
+// run out of memory and to add the run file, so that searches don't wait for
+// the disk. The lines are not found by searches in between.
+//
+void SearchIndex::flush()
+{
+	QVector<LineLocation> memoryLines;
+	QHash<QByteArray, QVector<quint32>> memoryPostings;
+	Run run;
+
+	{
+		QMutexLocker locker (&m_mutex);
+
+		if (m_memoryLines.isEmpty())
+			return;
+
+		memoryLines.swap (m_memoryLines);
+		memoryPostings.swap (m_memoryPostings);
+		run.firstFlush = run.lastFlush = m_nextFlush++;
+	}
+
+	run.level = 0;
+	run.lineCount = memoryLines.size();
+	run.termCount = 0;
+	run.postingsOffset = RunHeaderSize + (qint64 (run.lineCount) * LineEntrySize);
+	run.termsOffset = run.dictionaryOffset = 0;
+
+	const QString path = runPath (run.firstFlush, run.lastFlush);
+	QFile file (path + ".tmp");
+	QList<QByteArray> terms = memoryPostings.keys();
+	QVector<DictionaryEntry> dictionary;
+	QByteArray termData;
+	QByteArray buffer;
+	quint32 postingCount = 0;
+	qSort (terms.begin(), terms.end(), isTermLessThan);
+
+	if (QDir().mkpath (m_directory) == false
+		|| file.open (QIODevice::WriteOnly | QIODevice::Truncate) == false)
+	{
+		fprint (stderr, "couldn't write search index run %1\n", path);
+	}
+	else
+	{
+		writeRunHeader (file, run);
+
+		for (const LineLocation& line : memoryLines)
+			appendLineLocation (buffer, line);
+
+		for (const QByteArray& term : terms)
+		{
+			const QVector<quint32>& postings = memoryPostings[term];
+			DictionaryEntry entry;
+			entry.termOffset = termData.size();
+			entry.termLength = term.size();
+			entry.firstPosting = postingCount;
+			entry.postingCount = postings.size();
+			postingCount += postings.size();
+			termData += term;
+			dictionary << entry;
+
+			for (quint32 line : postings)
+				appendInteger (buffer, line);
+		}
+
+		file.write (buffer);
+
+		if (finishRun (file, run, termData, dictionary, path) && openRun (path, run))
+		{
+			QMutexLocker locker (&m_mutex);
+			m_runs << run;
+		}
+		else
+			fprint (stderr, "couldn't write search index run %1\n", path);
+	}
+
+	// The lines are dropped even if they could not be written, they would
+	// only pile up otherwise.
+}
+
+// =============================================================================
+//
+// Merges runs of the same level into one of the next level for as long as
+// there are enough of them. The runs are not touched by anything else while
+// this reads them, since only the writer thread removes runs, so the mutex is
+// only held to replace them once the merged run is written.
+//
+void SearchIndex::mergeRuns()
+{
+	forever
+	{
+		QList<Run> runs;
+
+		{
+			QMutexLocker locker (&m_mutex);
+			int count = 0;
+
+			while (count < m_runs.size()
+				&& m_runs[m_runs.size() - 1 - count].level == m_runs.last().level)
+			{
+				count++;
+			}
+
+			if (count < MergeFactor)
+				return;
+
+			runs = m_runs.mid (m_runs.size() - count);
+		}
+
+		const QString path = runPath (runs.first().firstFlush, runs.last().lastFlush);
+		Run merged;
+
+		if (writeMergedRun (runs, path) == false || openRun (path, merged) == false)
+		{
+			fprint (stderr, "couldn't merge search index runs into %1\n", path);
+			return;
+		}
+
+		{
+			QMutexLocker locker (&m_mutex);
+
+			// Runs are only ever added by this thread as well, so the merged
+			// runs are still the newest ones.
+			m_runs.erase (m_runs.end() - runs.size(), m_runs.end());
+			m_runs << merged;
+		}
+
+		for (Run& run : runs)
+		{
+			delete run.file;
+			QFile::remove (run.path);
+		}
+	}
+}
+
+// =============================================================================
+//
+// Writes @runs merged into one run of the next level to @path. The line tables
+// are concatenated and the postings of each term are joined in the order of
+// the runs, so they stay in ascending order.
+//
+bool SearchIndex::writeMergedRun (const QList<Run>& runs, const QString& path)
+{
+	Run merged;
+	QVector<quint32> lineBases;
+	QVector<qint64> cursors (runs.size(), 0);
+	QVector<DictionaryEntry> dictionary;
+	QByteArray termData;
+	QByteArray buffer;
+	quint32 postingCount = 0;
+	QFile file (path + ".tmp");
+
+	merged.level = runs.first().level + 1;
+	merged.lineCount = 0;
+	merged.termCount = 0;
+	merged.termsOffset = merged.dictionaryOffset = 0;
+
+	for (const Run& run : runs)
+	{
+		lineBases << merged.lineCount;
+		merged.lineCount += run.lineCount;
+	}
+
+	merged.postingsOffset = RunHeaderSize + (qint64 (merged.lineCount) * LineEntrySize);
+
+	if (file.open (QIODevice::WriteOnly | QIODevice::Truncate) == false)
+		return false;
+
+	writeRunHeader (file, merged);
+
+	for (const Run& run : runs)
+	{
+		file.write (reinterpret_cast<const char*> (run.data) + RunHeaderSize,
+			qint64 (run.lineCount) * LineEntrySize);
+	}
+
+	forever
+	{
+		// Find the smallest term at the cursors.
+		const uchar* term = null;
+		int termLength = 0;
+
+		for (int i = 0; i < runs.size(); ++i)
+		{
+			if (cursors[i] == runs[i].termCount)
+				continue;
+
+			const uchar* entry = dictionaryEntry (runs[i], cursors[i]);
+			const int length = qFromLittleEndian<quint32> (entry + 4);
+
+			if (term == null || compareTerms (termOfEntry (runs[i], entry), length, term, termLength) < 0)
+			{
+				term = termOfEntry (runs[i], entry);
+				termLength = length;
+			}
+		}
+
+		if (term == null)
+			break;
+
+		DictionaryEntry merging;
+		merging.termOffset = termData.size();
+		merging.termLength = termLength;
+		merging.firstPosting = postingCount;
+		merging.postingCount = 0;
+		termData.append (reinterpret_cast<const char*> (term), termLength);
+
+		for (int i = 0; i < runs.size(); ++i)
+		{
+			if (cursors[i] == runs[i].termCount)
+				continue;
+
+			const uchar* entry = dictionaryEntry (runs[i], cursors[i]);
+
+			if (compareTerms (termOfEntry (runs[i], entry), qFromLittleEndian<quint32> (entry + 4),
+				term, termLength) != 0)
+			{
+				continue;
+			}
+
+			const PostingList postings = postingsOfEntry (runs[i], entry);
+
+			for (qint64 j = 0; j < postings.count; ++j)
+				appendInteger (buffer, postings.at (j) + lineBases[i]);
+
+			merging.postingCount += postings.count;
+			cursors[i]++;
+		}
+
+		postingCount += merging.postingCount;
+		dictionary << merging;
+
+		if (buffer.size() >= (1 << 20))
+		{
+			file.write (buffer);
+			buffer.clear();
+		}
+	}
+
+	file.write (buffer);
+	return finishRun (file, merged, termData, dictionary, path);
+}
+
+// =============================================================================
+//
+// Finds up to @limit lines which have all of @terms, newest first. If @channel
+// is given, only the logs of channels or queries of that name are searched.
+// @channel is spelled as in log names, see Context::logNameOf().
+//
+QList<SearchHit> SearchIndex::search (const QStringList& terms, const QString& channel, int limit)
+{
+	QList<SearchHit> hits;
+	QList<QByteArray> keys;
+
+	for (const QString& term : terms)
+	{
+		if (keys.contains (term.toUtf8()) == false)
+			keys << term.toUtf8();
+	}
+
+	if (keys.isEmpty() || limit <= 0)
+		return hits;
+
+	QMutexLocker locker (&m_mutex);
+	QVector<bool> isLogSearched (m_logNames.size(), channel.isEmpty());
+
+	if (channel.isEmpty() == false)
+	{
+		for (int i = 0; i < m_logNames.size(); ++i)
+			isLogSearched[i] = (m_logNames[i].section ('/', -1) == channel);
+	}
+
+	auto addHit = [&] (const LineLocation& line) -> bool
+	{
+		if (line.logId < quint32 (isLogSearched.size()) && isLogSearched[line.logId])
+		{
+			SearchHit hit;
+			hit.logName = m_logNames[line.logId];
+			hit.segmentStart = line.segmentStart;
+			hit.offset = line.offset;
+			hits << hit;
+		}
+
+		return hits.size() < limit;
+	};
+
+	// The run in memory has the newest lines.
+	QVector<PostingList> lists;
+
+	for (const QByteArray& key : keys)
+	{
+		auto it = m_memoryPostings.constFind (key);
+
+		if (it == m_memoryPostings.constEnd())
+			break;
+
+		PostingList list;
+		list.native = it.value().constData();
+		list.count = it.value().size();
+		lists << list;
+	}
+
+	if (lists.size() == keys.size())
+		intersect (lists, [&] (quint32 line) { return addHit (m_memoryLines[line]); });
+
+	for (int i = m_runs.size() - 1; i >= 0 && hits.size() < limit; --i)
+	{
+		const Run& run = m_runs[i];
+		lists.clear();
+
+		if (findPostings (run, keys, lists))
+			intersect (lists, [&] (quint32 line) { return addHit (lineOfRun (run, line)); });
+	}
+
+	return hits;
+}
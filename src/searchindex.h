@@ -0,0 +1,102 @@
+#ifndef SPEECHBUBBLE_SEARCHINDEX_H
+#define SPEECHBUBBLE_SEARCHINDEX_H
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+#include "main.h"
+
+// =============================================================================
+//
+// A line found by a search: the log it is in, the segment of the log and the
+// offset of the line's record in the segment.
+//
+struct SearchHit
+{
+	QString		logName;
+	qint64		segmentStart;
+	qint64		offset;
+};
+
+// =============================================================================
+//
+// Inverted index over every logged line, kept next to the logs. The terms of a
+// line are its words, lowercased, and "nick:<nick>" for lines said by someone.
+//
+// New lines go into a run in memory. Once that has enough lines it is written
+// out as an immutable run file, and whenever MergeFactor runs of the same level
+// have piled up they are merged into one run of the next level. Runs cover
+// consecutive ranges of flushes, named in the file names, so a run left behind
+// by an interrupted merge is recognized by its range being covered by another.
+//
+//     <first>-<last>.sbsr:  header, line table, postings, terms, dictionary
+//
+// Lines are numbered in the order they were logged within each run. The line
+// table gives the location of each line, the postings of a term are the
+// ascending line numbers of the lines with the term, and the dictionary is
+// sorted by term for binary search.
+//
+// The writer thread adds lines, flushes and merges. Searches come from the GUI
+// thread. The mutex is held while either thread touches the run in memory, the
+// list of runs or the list of logs, but not while run files are written or the
+// list of logs is saved.
+//
+class SearchIndex
+{
+	DELETE_COPY (SearchIndex)
+
+public:
+	struct LineLocation
+	{
+		quint32		logId;
+		quint32		offset;
+		qint64		segmentStart;
+	};
+
+	struct Run
+	{
+		QString			path;
+		QFile*			file;
+		const uchar*	data;
+		qint64			firstFlush;
+		qint64			lastFlush;
+		int				level;
+		quint32			lineCount;
+		quint32			termCount;
+		qint64			postingsOffset;
+		qint64			termsOffset;
+		qint64			dictionaryOffset;
+	};
+
+	SearchIndex (const QString& directory);
+	~SearchIndex();
+
+	void					addLine (const QString& logName, qint64 segmentStart,
+								qint64 offset, const QString& nick, const QByteArray& text);
+	void					flush();
+	bool					isFull() const;
+	void					load();
+	void					mergeRuns();
+	QList<SearchHit>		search (const QStringList& terms, const QString& channel, int limit);
+
+	static QString			nickTerm (const QString& nick);
+	static QStringList		termsOf (const QString& text);
+
+private:
+	quint32					logIdOf (const QString& logName);
+	bool					openRun (const QString& path, Run& run);
+	QString					runPath (qint64 firstFlush, qint64 lastFlush) const;
+	bool					writeMergedRun (const QList<Run>& runs, const QString& path);
+
+	QMutex					m_mutex;
+	QString					m_directory;
+	QList<Run>				m_runs;		// oldest first
+	qint64					m_nextFlush;
+	QVector<LineLocation>	m_memoryLines;
+	QHash<QByteArray, QVector<quint32>> m_memoryPostings;
+	QStringList				m_logNames;
+	QHash<QString, quint32>	m_logIds;
+};
+
+#endif // SPEECHBUBBLE_SEARCHINDEX_H
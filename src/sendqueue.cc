@@ -0,0 +1,77 @@
+#include "sendqueue.h"
+#include "config.h"
+
+CONFIG (Bool,	flood_control,		true)
+CONFIG (Int,	flood_penalty,		2000)	// msec added to the message timer per line
+CONFIG (Int,	flood_window,		10000)	// msec the message timer may run ahead
+
+// =============================================================================
+//
+SendQueue::SendQueue() :
+	m_messageTimer (0) {}
+
+// =============================================================================
+//
+void SendQueue::clear()
+{
+	for (QQueue<QByteArray>& queue : m_queues)
+		queue.clear();
+}
+
+// =============================================================================
+//
+int SendQueue::depth() const
+{
+	int result = 0;
+
+	for (const QQueue<QByteArray>& queue : m_queues)
+		result += queue.size();
+
+	return result;
+}
+
+// =============================================================================
+//
+void SendQueue::enqueue (const QByteArray& line, SendPriority priority)
+{
+	m_queues[priority].enqueue (line);
+}
+
+// =============================================================================
+//
+// Appends to @out as many queued lines as the flood limits allow at time @now,
+// in order of priority. Returns the amount of msec until the next line may be
+// sent, 0 if the queue was emptied.
+//
+// High priority lines may run one penalty further ahead than the others, so
+// that a PONG still gets out right after bulk traffic has used up the window
+// instead of waiting behind it past the server's ping timeout.
+//
+qint64 SendQueue::takeAllowed (QByteArray& out, qint64 now)
+{
+	if (m_messageTimer < now)
+		m_messageTimer = now;
+
+	for (int priority = 0; priority < SendPriority_Count; ++priority)
+	{
+		QQueue<QByteArray>& queue = m_queues[priority];
+		const qint64 window = cfg::flood_window
+			+ ((priority == SendPriority_High) ? cfg::flood_penalty : 0);
+
+		while (queue.isEmpty() == false)
+		{
+			if (cfg::flood_control && m_messageTimer - now >= window)
+				return m_messageTimer - now - window + 1;
+
+			const QByteArray& line = queue.head();
+
+			// Longer lines cost more, an extra second per 120 bytes as servers
+			// usually count it.
+			m_messageTimer += cfg::flood_penalty + (line.size() / 120) * 1000;
+			out += line;
+			queue.dequeue();
+		}
+	}
+
+	return 0;
+}
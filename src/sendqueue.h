@@ -0,0 +1,43 @@
+#ifndef SPEECHBUBBLE_SENDQUEUE_H
+#define SPEECHBUBBLE_SENDQUEUE_H
+
+#include <QByteArray>
+#include <QQueue>
+#include "main.h"
+
+// =============================================================================
+//
+// Priority of an outgoing line. Lines of higher priority are always sent
+// before any lines of lower priority.
+//
+enum SendPriority
+{
+	SendPriority_High,		// PONG and whatever the user typed
+	SendPriority_Normal,
+	SendPriority_Bulk,		// automatic traffic such as WHO and CTCP replies
+
+	SendPriority_Count
+};
+
+// =============================================================================
+//
+// Outbound queue of a connection with RFC 1459 style flood control. Every sent
+// line adds a penalty to a message timer which may run ahead of the clock by at
+// most the flood window. Once it is that far ahead, lines wait in the queue.
+//
+class SendQueue
+{
+public:
+	SendQueue();
+
+	void			clear();
+	int				depth() const;
+	void			enqueue (const QByteArray& line, SendPriority priority);
+	qint64			takeAllowed (QByteArray& out, qint64 now);
+
+private:
+	QQueue<QByteArray>	m_queues[SendPriority_Count];
+	qint64				m_messageTimer;
+};
+
+#endif // SPEECHBUBBLE_SENDQUEUE_H
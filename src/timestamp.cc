@@ -0,0 +1,98 @@
+#include <QDateTime>
+#include "timestamp.h"
+#include "config.h"
+
+CONFIG (String, timestamp_format, "hh:mm:ss")
+
+// The timestamp format with its millisecond fields replaced by a marker. The
+// rest only depends on the second and is formatted by QDateTime in one go, so
+// that fields which depend on each other, like "h" and "AP", still do.
+static const QChar	g_msecMarker (0xE000);	// a private use character
+static QString		g_markedFormat;
+static QList<int>	g_msecFieldWidths;	// 1 for "z", 3 for "zzz"
+static bool			g_isCompiled = false;
+
+// The formatted timestamp split at the markers, for the second it was last
+// needed for.
+static qint64		g_cachedSecond = -1;
+static QStringList	g_cachedParts;
+static QString		g_result;
+
+// =============================================================================
+//
+// Replaces the millisecond fields of the timestamp_format setting with markers.
+// Quoted text is left alone.
+//
+void applyTimestampFormat()
+{
+	const QString& fmt = cfg::timestamp_format;
+	bool quoted = false;
+
+	g_markedFormat.clear();
+	g_msecFieldWidths.clear();
+	g_cachedSecond = -1;
+	g_isCompiled = true;
+
+	for (int i = 0; i < fmt.length(); ++i)
+	{
+		if (fmt[i] == '\'')
+			quoted = !quoted;
+
+		if (quoted || fmt[i] != 'z')
+		{
+			g_markedFormat += fmt[i];
+			continue;
+		}
+
+		// "zzz" is zero-padded, a lone "z" is not.
+		int width = 1;
+
+		if (fmt.midRef (i, 3) == QLatin1String ("zzz"))
+		{
+			width = 3;
+			i += 2;
+		}
+
+		g_markedFormat += g_msecMarker;
+		g_msecFieldWidths << width;
+	}
+}
+
+// =============================================================================
+//
+const QString& formatTimestamp (qint64 msecs)
+{
+	if (g_isCompiled == false)
+		applyTimestampFormat();
+
+	const qint64 second = msecs / 1000;
+	const bool hasMsecs = (g_msecFieldWidths.isEmpty() == false);
+
+	if (second != g_cachedSecond)
+	{
+		const QDateTime time = QDateTime::fromMSecsSinceEpoch (second * 1000);
+		g_cachedSecond = second;
+		g_cachedParts = time.toString (g_markedFormat).split (g_msecMarker);
+
+		if (hasMsecs == false)
+			g_result = format (COLOR_STR "2[%1]" NORMAL_STR " ", g_cachedParts[0]);
+	}
+	elif (hasMsecs == false)
+		return g_result;
+
+	if (hasMsecs)
+	{
+		const int msec = msecs % 1000;
+		QString timestamp = g_cachedParts[0];
+
+		for (int i = 0; i < g_msecFieldWidths.size() && i + 1 < g_cachedParts.size(); ++i)
+		{
+			timestamp += QString::number (msec).rightJustified (g_msecFieldWidths[i], '0');
+			timestamp += g_cachedParts[i + 1];
+		}
+
+		g_result = format (COLOR_STR "2[%1]" NORMAL_STR " ", timestamp);
+	}
+
+	return g_result;
+}
@@ -0,0 +1,26 @@
+#ifndef SPEECHBUBBLE_TIMESTAMP_H
+#define SPEECHBUBBLE_TIMESTAMP_H
+
+#include "main.h"
+
+// =============================================================================
+//
+// Returns the timestamp shown in front of a line printed at @msecs since the
+// epoch, formatting codes included. The format is the timestamp_format setting,
+// which uses the syntax of QDateTime::toString, "z" and "zzz" for milliseconds
+// included.
+//
+// Consecutive lines are usually printed within the same second, so the parts of
+// the timestamp which don't depend on milliseconds are formatted only once per
+// second. The returned reference is valid until the next call.
+//
+const QString& formatTimestamp (qint64 msecs);
+
+// =============================================================================
+//
+// Prepares formatTimestamp for the current timestamp_format setting. Must be
+// called whenever the setting has changed, formatTimestamp does not check.
+//
+void applyTimestampFormat();
+
+#endif // SPEECHBUBBLE_TIMESTAMP_H
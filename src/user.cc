@@ -9,7 +9,11 @@ IRCUser::~IRCUser()
 	flags |= FDoNotDelete;
 	connection->forgetUser (this);
 
-	for (IRCChannel* chan : channels)
+	// Removing us from a channel drops it from our channel list, so iterate
+	// over a copy.
+	const QList<IRCChannel*> chans = channels;
+
+	for (IRCChannel* chan : chans)
 		chan->removeUser (this);
 }
 
@@ -29,6 +33,20 @@ QString IRCUser::getUserHost() const
 	return format ("%1!%2@%3", nickname, username, hostname);
 }
 
+// =============================================================================
+//
+// Stores the user and host parts of this user's mask as seen in a message
+// prefix. Nothing is copied if they are already up to date.
+//
+void IRCUser::updateUserHost (const QStringRef& user, const QStringRef& host)
+{
+	if (username != user)
+		username = user.toString();
+
+	if (hostname != host)
+		hostname = host.toString();
+}
+
 // =============================================================================
 //
 QString IRCUser::describe() const
@@ -45,6 +45,7 @@ public:
 	void		dropKnownChannel (IRCChannel* chan);
 	QString		describe() const;
 	QString		getUserHost() const;
+	void		updateUserHost (const QStringRef& user, const QStringRef& host);
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS (IRCUser::Flags)
@@ -0,0 +1,218 @@
+#include <QtAlgorithms>
+#include "userlistmodel.h"
+#include "channel.h"
+#include "user.h"
+
+// =============================================================================
+//
+UserlistModel::UserlistModel (IRCChannel* channel) :
+	QAbstractListModel (channel),
+	m_channel (channel),
+	m_isDisplayed (false),
+	m_isStale (true) {}
+
+// =============================================================================
+//
+bool UserlistModel::Row::operator< (const Row& other) const
+{
+	if (rank != other.rank)
+		return rank > other.rank;
+
+	if (sortName != other.sortName)
+		return sortName < other.sortName;
+
+	return user < other.user;
+}
+
+// =============================================================================
+//
+UserlistModel::Row UserlistModel::makeRow (IRCUser* user) const
+{
+	Row row;
+	row.rank = int (m_channel->getEffectiveStatusOf (user));
+	row.sortName = user->nickname.toLower();
+	row.user = user;
+	row.nickname = user->nickname;
+	row.toolTip = format ("%1 (%2)", user->getUserHost(),
+		IRCChannel::getStatusName (m_channel->getStatusOf (user)));
+	return row;
+}
+
+// =============================================================================
+//
+// Returns the row at which @key is, or would be inserted at.
+//
+int UserlistModel::findRow (const Row& key) const
+{
+	return qLowerBound (m_rows.begin(), m_rows.end(), key) - m_rows.begin();
+}
+
+// =============================================================================
+//
+int UserlistModel::rowCount (const QModelIndex& parent) const
+{
+	return parent.isValid() ? 0 : m_rows.size();
+}
+
+// =============================================================================
+//
+QVariant UserlistModel::data (const QModelIndex& index, int role) const
+{
+	if (index.isValid() == false || index.row() >= m_rows.size())
+		return QVariant();
+
+	const Row& row = m_rows[index.row()];
+
+	switch (role)
+	{
+		case Qt::DisplayRole:
+			return row.nickname;
+
+		case Qt::ToolTipRole:
+			return row.toolTip;
+	}
+
+	return QVariant();
+}
+
+// =============================================================================
+//
+IRCUser* UserlistModel::userAt (int row) const
+{
+	return isWithinRange (row, 0, m_rows.size() - 1) ? m_rows[row].user : null;
+}
+
+// =============================================================================
+//
+// Rebuilds the model from the userlist of the channel.
+//
+void UserlistModel::reset() // [slot]
+{
+	beginResetModel();
+	m_rows.clear();
+	m_rowsByUser.clear();
+
+	for (UserlistEntry* e : m_channel->userlist)
+	{
+		Row row = makeRow (e->userInfo);
+		m_rows << row;
+		m_rowsByUser.insert (row.user, row);
+	}
+
+	qSort (m_rows);
+	m_isStale = false;
+	endResetModel();
+}
+
+// =============================================================================
+//
+void UserlistModel::setDisplayed (bool displayed)
+{
+	m_isDisplayed = displayed;
+
+	if (m_isDisplayed && m_isStale)
+		reset();
+}
+
+// =============================================================================
+//
+// Applies @delta row by row. Each row costs a shift of the rows after it, so a
+// delta touching a large part of the list, like a netsplit or a netjoin, is
+// applied by rebuilding the model in one go instead.
+//
+void UserlistModel::applyDelta (const UserlistDelta& delta) // [slot]
+{
+	if (m_isDisplayed == false)
+	{
+		m_isStale = true;
+		return;
+	}
+
+	const int size = delta.removed.size() + delta.changed.size() + delta.added.size();
+
+	if (size > 32 && size > m_rows.size() / 8)
+	{
+		reset();
+		return;
+	}
+
+	for (IRCUser* user : delta.removed)
+		removeUser (user);
+
+	for (IRCUser* user : delta.changed)
+		updateUser (user);
+
+	for (IRCUser* user : delta.added)
+		insertUser (user);
+}
+
+// =============================================================================
+//
+void UserlistModel::insertUser (IRCUser* user)
+{
+	if (m_rowsByUser.contains (user))
+	{
+		updateUser (user);
+		return;
+	}
+
+	Row row = makeRow (user);
+	const int i = findRow (row);
+	beginInsertRows (QModelIndex(), i, i);
+	m_rows.insert (i, row);
+	m_rowsByUser.insert (user, row);
+	endInsertRows();
+}
+
+// =============================================================================
+//
+void UserlistModel::removeUser (IRCUser* user)
+{
+	auto it = m_rowsByUser.find (user);
+
+	if (it == m_rowsByUser.end())
+		return;
+
+	const int i = findRow (it.value());
+	beginRemoveRows (QModelIndex(), i, i);
+	m_rows.removeAt (i);
+	m_rowsByUser.erase (it);
+	endRemoveRows();
+}
+
+// =============================================================================
+//
+// Re-sorts @user after a change of status or nickname. The row is moved only if
+// its position actually changes.
+//
+void UserlistModel::updateUser (IRCUser* user)
+{
+	auto it = m_rowsByUser.find (user);
+
+	if (it == m_rowsByUser.end())
+		return;
+
+	const int from = findRow (it.value());
+	const Row row = makeRow (user);
+	int to = findRow (row);
+
+	// The old row is still in the list, which must not count for the position
+	// the row ends up at.
+	if (to > from)
+		to--;
+
+	if (to != from)
+	{
+		// beginMoveRows wants the destination as it is before the move.
+		beginMoveRows (QModelIndex(), from, from, QModelIndex(), (to > from) ? to + 1 : to);
+		m_rows.removeAt (from);
+		m_rows.insert (to, row);
+		endMoveRows();
+	}
+	else
+		m_rows[from] = row;
+
+	it.value() = row;
+	const QModelIndex index = createIndex (to, 0);
+	emit dataChanged (index, index);
+}
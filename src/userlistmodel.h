@@ -0,0 +1,67 @@
+#ifndef SPEECHBUBBLE_USERLISTMODEL_H
+#define SPEECHBUBBLE_USERLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include "main.h"
+
+class IRCChannel;
+class IRCUser;
+struct UserlistDelta;
+
+// =============================================================================
+//
+// The members of a channel as shown in the userlist, sorted by status and then
+// by name. Each row carries a precomputed sort key, so changes are placed with
+// a binary search and announced to views row by row. Rows are kept in a plain
+// list, so each of them still shifts the rows after it; large changes rebuild
+// the model instead.
+//
+// Models of channels which are not being displayed ignore changes and are
+// rebuilt when they are displayed again.
+//
+class UserlistModel : public QAbstractListModel
+{
+	Q_OBJECT
+
+public:
+	explicit UserlistModel (IRCChannel* channel);
+
+	QVariant		data (const QModelIndex& index, int role = Qt::DisplayRole) const override;
+	int				rowCount (const QModelIndex& parent = QModelIndex()) const override;
+	void			setDisplayed (bool displayed);
+	IRCUser*		userAt (int row) const;
+
+public slots:
+	void			applyDelta (const UserlistDelta& delta);
+	void			reset();
+
+private:
+	// Rows carry what they display, the user is only used to tell rows apart
+	// and is never dereferenced, since changes to the userlist may arrive
+	// after the user is gone.
+	struct Row
+	{
+		int			rank;		// higher status first
+		QString		sortName;	// then by lowercased nickname
+		IRCUser*	user;		// and finally by pointer, to keep keys unique
+		QString		nickname;
+		QString		toolTip;
+
+		bool operator< (const Row& other) const;
+	};
+
+	int				findRow (const Row& key) const;
+	void			insertUser (IRCUser* user);
+	Row				makeRow (IRCUser* user) const;
+	void			removeUser (IRCUser* user);
+	void			updateUser (IRCUser* user);
+
+	IRCChannel*					m_channel;
+	bool						m_isDisplayed;
+	bool						m_isStale;
+	QList<Row>					m_rows;
+	QHash<IRCUser*, Row>		m_rowsByUser;
+};
+
+#endif // SPEECHBUBBLE_USERLISTMODEL_H
@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <QFile>
 #include <QVector>
 #include <QStringList>
 #include "main.h"
@@ -61,37 +62,32 @@ XMLDocument* XMLDocument::newDocument (QString rootName)
 //
 XMLDocument* XMLDocument::loadFromFile (QString fname)
 {
-	FILE*			fp = null;
-	long			fsize;
-	char*			buf = null;
+	QFile			file (fname);
 	XMLNode*		root = null;
 	HeaderType		header;
 
 	try
 	{
-		if ((fp = fopen (fname.toStdString().c_str(), "r")) == null)
-			throw format ("couldn't open %1 for reading: %2", fname, strerror (errno));
+		if (file.open (QIODevice::ReadOnly) == false)
+			throw format ("couldn't open %1 for reading: %2", fname, file.errorString());
 
-		fseek (fp, 0l, SEEK_END);
-		fsize = ftell (fp);
-		rewind (fp);
-		buf = new char[fsize + 1];
+		// The scanner works on the mapped file directly, the mapping lasts
+		// until the file is closed when this returns.
+		const qint64 size = file.size();
+		const uchar* data = (size > 0) ? file.map (0, size) : null;
 
-		if ((long) fread (buf, 1, fsize, fp) < fsize)
+		if (data == null)
 			throw format ("I/O error while opening %1", fname);
 
-		buf[fsize] = '\0';
-		fclose (fp);
-		fp = null;
-		XMLScanner scan (buf);
+		XMLScanner scan (reinterpret_cast<const char*> (data), size);
 		scan.mustScanNext (XMLScanner::EHeaderStart);
 
 		while (scan.scanNextToken (XMLScanner::ESymbol))
 		{
-			QString attrname = scan.token;
+			QString attrname = scan.token();
 			scan.mustScanNext (XMLScanner::EEquals);
 			scan.mustScanNext (XMLScanner::EString);
-			header[attrname] = scan.token;
+			header[attrname] = scan.token();
 		}
 
 		scan.mustScanNext (XMLScanner::EHeaderEnd);
@@ -106,7 +102,7 @@ XMLDocument* XMLDocument::loadFromFile (QString fname)
 				case XMLScanner::ETagStart:
 				{
 					scan.mustScanNext (XMLScanner::ESymbol);
-					XMLNode* node = new XMLNode (scan.token, topStackNode());
+					XMLNode* node = new XMLNode (scan.token(), topStackNode());
 
 					if (g_stack.size() == 0)
 					{
@@ -124,10 +120,10 @@ XMLDocument* XMLDocument::loadFromFile (QString fname)
 
 					while (scan.scanNextToken (XMLScanner::ESymbol))
 					{
-						QString attrname = scan.token;
+						QString attrname = scan.token();
 						scan.mustScanNext (XMLScanner::EEquals);
 						scan.mustScanNext (XMLScanner::EString);
-						node->setAttribute (attrname, scan.token);
+						node->setAttribute (attrname, scan.token());
 						assert (node->hasAttribute (attrname));
 					}
 
@@ -146,7 +142,7 @@ XMLDocument* XMLDocument::loadFromFile (QString fname)
 					scan.mustScanNext (XMLScanner::ESymbol);
 					XMLNode* popee;
 
-					if (!pop (g_stack, popee) || popee->name != scan.token)
+					if (!pop (g_stack, popee) || scan.tokenEquals (popee->name) == false)
 						throw std::logic_error ("Misplaced closing tag");
 
 					scan.mustScanNext (XMLScanner::ETagEnd);
@@ -162,7 +158,7 @@ XMLDocument* XMLDocument::loadFromFile (QString fname)
 					XMLNode* node = g_stack[g_stack.size() - 1];
 
 					node->isCData = (scan.tokenType == XMLScanner::ECData);
-					node->contents = (node->isCData ? decodeString (scan.token) : scan.token);
+					node->contents = (node->isCData ? decodeString (scan.token()) : scan.token());
 				}
 				break;
 
@@ -172,7 +168,7 @@ XMLDocument* XMLDocument::loadFromFile (QString fname)
 				case XMLScanner::EEquals:
 				case XMLScanner::ETagSelfCloser:
 				case XMLScanner::ETagEnd:
-					throw format ("Unexpected token '%1'", scan.token);
+					throw format ("Unexpected token '%1'", scan.token());
 					break;
 			}
 		}
@@ -180,16 +176,10 @@ XMLDocument* XMLDocument::loadFromFile (QString fname)
 	catch (QString e)
 	{
 		g_errorString = e;
-		delete[] buf;
 		delete root;
-
-		if (fp != null)
-			fclose (fp);
-
 		return null;
 	}
 
-	delete[] buf;
 	XMLDocument* doc = new XMLDocument (root);
 	doc->header = header;
 	return doc;
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include "xml_scanner.h"
 #include "xml_document.h"
 
@@ -16,152 +18,215 @@ static const char* g_XMLTokens[] =
 	"a string",			// EString
 };
 
-// Amount of tokens which are processed from tokens above
-static const int	gNumNamedTokens = 6;
-static const char*	gCDataStart   = "<![CDATA[";
-static const char*	g_CDataEnd     = "]]>";
-static const char*	gCommentStart = "<!--";
-static const char*	gCommentEnd   = "-->";
-
 // =============================================================================
 //
-XMLScanner::XMLScanner (const char* data) :
-	data (data),
-	position (&data[0]),
+XMLScanner::XMLScanner (const char* data, qint64 length) :
+	position (data),
+	end (data + length),
+	tokenStart (data),
+	tokenLength (0),
+	tokenType (ESymbol),
+	hasEscapes (false),
 	isInsideTag (false),
 	lineNumber (0) {}
 
 // =============================================================================
 //
-bool XMLScanner::checkString (const char* c, bool peek)
+// Returns whether the input continues with the @length characters of @text.
+//
+bool XMLScanner::startsWith (const char* text, int length) const
 {
-	const bool r = strncmp (position, c, strlen (c)) == 0;
-
-	if (r && peek == false)
-		position += strlen (c);
-
-	return r;
+	return end - position >= length && memcmp (position, text, length) == 0;
 }
 
 // =============================================================================
 //
-bool XMLScanner::scanNextToken()
+// Returns where @text of @length characters next occurs in the input, or null
+// if it does not.
+//
+const char* XMLScanner::find (const char* text, int length) const
 {
-	token = "";
-
-	while (isspace (*position))
+	for (const char* it = position; end - it >= length; ++it)
 	{
-		if (*position == '\n')
-			lineNumber++;
-
-		position++;
+		if (*it == text[0] && memcmp (it, text, length) == 0)
+			return it;
 	}
 
-	if (*position == '\0')
-		return false;
+	return null;
+}
 
-	// Skip any comments
-	while (checkString (gCommentStart))
-		while (checkString (gCommentEnd) == false)
-			position++;
+// =============================================================================
+//
+void XMLScanner::setToken (EToken tok, const char* start, int length)
+{
+	tokenType = tok;
+	tokenStart = start;
+	tokenLength = length;
+}
 
-	// Check and parse CDATA
-	if (checkString (gCDataStart))
+// =============================================================================
+//
+// Skips whitespace and comments.
+//
+void XMLScanner::skipIgnored()
+{
+	while (position < end)
 	{
-		while (!checkString (g_CDataEnd))
+		if (*position == '\n')
 		{
-			token = token + *position;
+			lineNumber++;
 			position++;
 		}
-
-		tokenType = ECData;
-		return true;
-	}
-
-	// Check "<", ">", "/>", ...
-	for (int i = 0; i < gNumNamedTokens; ++i)
-	{
-		if (checkString (g_XMLTokens[i]))
+		elif (isspace (static_cast<unsigned char> (*position)))
+			position++;
+		elif (startsWith ("<!--", 4))
 		{
-			token = g_XMLTokens[i];
-			tokenType = static_cast<EToken> (i);
+			const char* commentEnd = find ("-->", 3);
 
-			// We need to keep track of when we're inside node tags so we can
-			// stop on '=' signs for attributes when inside tags where '=' has
-			// special meaning but not outside tags where it's just a glyph.
-			if (i == ETagStart || i == EHeaderStart)
-				isInsideTag = true;
-			elif (i == ETagEnd || ETagSelfCloser || i == EHeaderEnd)
-				isInsideTag = false;
+			if (commentEnd == null)
+				throw format ("unterminated comment on line %1", lineNumber + 1);
 
-			return true;
+			lineNumber += int (std::count (position, commentEnd, '\n'));
+			position = commentEnd + 3;
 		}
+		else
+			break;
 	}
+}
 
-	// Check and parse string
-	if (*position == '\"')
+// =============================================================================
+//
+bool XMLScanner::scanNamedToken (EToken tok, int length)
+{
+	setToken (tok, position, length);
+	position += length;
+
+	// We need to keep track of when we're inside node tags so we can stop on
+	// '=' signs for attributes when inside tags where '=' has special meaning
+	// but not outside tags where it's just a glyph.
+	isInsideTag = (tok == ETagStart || tok == ETagCloser || tok == EHeaderStart);
+	return true;
+}
+
+// =============================================================================
+//
+bool XMLScanner::scanNextToken()
+{
+	skipIgnored();
+	hasEscapes = false;
+
+	if (position == end)
 	{
-		position++;
+		setToken (tokenType, position, 0);
+		return false;
+	}
 
-		while (*position != '\"')
-		{
-			if (*position == '\0')
-				throw std::runtime_error ("unterminated string");
+	const bool isBeforeGreater = end - position >= 2 && position[1] == '>';
 
-			if (checkString ("\\\""))
+	switch (*position)
+	{
+		case '<':
+		{
+			if (startsWith ("<![CDATA[", 9))
 			{
-				token = token + "\"";
-				continue;
+				position += 9;
+				const char* dataEnd = find ("]]>", 3);
+
+				if (dataEnd == null)
+					throw format ("unterminated CDATA on line %1", lineNumber + 1);
+
+				setToken (ECData, position, dataEnd - position);
+				lineNumber += int (std::count (position, dataEnd, '\n'));
+				position = dataEnd + 3;
+				return true;
 			}
 
-			token = token + *position;
-			position++;
+			if (startsWith ("<?xml", 5))
+				return scanNamedToken (EHeaderStart, 5);
+
+			if (startsWith ("</", 2))
+				return scanNamedToken (ETagCloser, 2);
+
+			return scanNamedToken (ETagStart, 1);
 		}
 
-		tokenType = EString;
-		position++; // skip the final quote
-		return true;
-	}
+		case '>':
+			return scanNamedToken (ETagEnd, 1);
 
-	tokenType = ESymbol;
+		case '/':
+		{
+			if (isBeforeGreater)
+				return scanNamedToken (ETagSelfCloser, 2);
+		}
+		break;
 
-	while (*position != '\0')
-	{
-		if (isInsideTag && isspace (*position))
-			break;
+		case '?':
+		{
+			if (isBeforeGreater)
+				return scanNamedToken (EHeaderEnd, 2);
+		}
+		break;
 
-		// Stop at '=' if inside tag
-		if (isInsideTag && *position == '=')
+		case '=':
 		{
-			if (token.length() > 0)
-				break;
-			else
+			if (isInsideTag)
 			{
-				tokenType = EEquals;
-				token = "=";
+				setToken (EEquals, position, 1);
 				position++;
 				return true;
 			}
 		}
+		break;
 
-		bool stopHere = false;
-
-		for (int i = 0; i < (signed) (sizeof g_XMLTokens / sizeof * g_XMLTokens); ++i)
+		case '\"':
 		{
-			if (checkString (g_XMLTokens[i], true))
+			const char* start = ++position;
+
+			while (position < end && *position != '\"')
 			{
-				stopHere = true;
-				break;
+				if (*position == '\\' && end - position >= 2 && position[1] == '\"')
+				{
+					hasEscapes = true;
+					position += 2;
+					continue;
+				}
+
+				position++;
 			}
+
+			if (position == end)
+				throw format ("unterminated string on line %1", lineNumber + 1);
+
+			setToken (EString, start, position - start);
+			position++; // skip the final quote
+			return true;
 		}
 
-		if (stopHere)
+		default:
+			break;
+	}
+
+	// Anything else is a symbol, which runs until the next token. Inside tags
+	// it also ends at whitespace and '=' signs.
+	const char* start = position;
+
+	while (position < end)
+	{
+		const char c = *position;
+
+		if (c == '<' || c == '>')
+			break;
+
+		if ((c == '/' || c == '?') && end - position >= 2 && position[1] == '>')
+			break;
+
+		if (isInsideTag && (c == '=' || isspace (static_cast<unsigned char> (c))))
 			break;
 
-		token = token + *position;
 		position++;
 	}
 
+	setToken (ESymbol, start, position - start);
 	return true;
 }
 
@@ -170,6 +235,8 @@ bool XMLScanner::scanNextToken()
 bool XMLScanner::scanNextToken (EToken tok)
 {
 	const char* oldPosition = position;
+	const bool wasInsideTag = isInsideTag;
+	const int oldLineNumber = lineNumber;
 
 	if (scanNextToken() == false)
 		return false;
@@ -177,6 +244,8 @@ bool XMLScanner::scanNextToken (EToken tok)
 	if (tokenType != tok)
 	{
 		position = oldPosition;
+		isInsideTag = wasInsideTag;
+		lineNumber = oldLineNumber;
 		return false;
 	}
 
@@ -188,5 +257,43 @@ bool XMLScanner::scanNextToken (EToken tok)
 void XMLScanner::mustScanNext (XMLScanner::EToken tok)
 {
 	if (!scanNextToken (tok))
-		throw format ("Expected '%1', got '%2' instead", g_XMLTokens[tok], token);
+		throw format ("Expected '%1', got '%2' instead", g_XMLTokens[tok], token());
+}
+
+// =============================================================================
+//
+// Decodes the text of the current token.
+//
+QString XMLScanner::token() const
+{
+	QString text = QString::fromUtf8 (tokenStart, tokenLength);
+
+	if (hasEscapes)
+		text.replace ("\\\"", "\"");
+
+	return text;
+}
+
+// =============================================================================
+//
+// Returns whether the text of the current token is @text, without decoding the
+// token unless it has other than ASCII characters in it.
+//
+bool XMLScanner::tokenEquals (const QString& text) const
+{
+	if (hasEscapes)
+		return token() == text;
+
+	for (int i = 0; i < tokenLength; ++i)
+	{
+		const unsigned char c = tokenStart[i];
+
+		if (c >= 0x80)
+			return token() == text;
+
+		if (i >= text.length() || text[i].unicode() != c)
+			return false;
+	}
+
+	return text.length() == tokenLength;
 }
@@ -3,6 +3,13 @@
 
 #include "main.h"
 
+// =============================================================================
+//
+// Splits an XML document into tokens in a single pass over the buffer, which
+// is usually a mapped file and need not be null-terminated. A token is only a
+// span of the buffer; token() decodes it into a string for when the text is
+// actually needed, such as for node names and contents.
+//
 class XMLScanner
 {
 public:
@@ -20,23 +27,31 @@ public:
 		EString
 	};
 
-	PROPERTY (const char* data)
 	PROPERTY (const char* position)
-	PROPERTY (QString token)
+	PROPERTY (const char* end)
+	PROPERTY (const char* tokenStart)
+	PROPERTY (int tokenLength)
 	PROPERTY (EToken tokenType)
+	PROPERTY (bool hasEscapes)
 	PROPERTY (bool isInsideTag)
 	PROPERTY (int lineNumber)
 	CLASSDATA (XMLScanner)
 
 public:
-	XMLScanner (const char* data);
+	XMLScanner (const char* data, qint64 length);
 
-	bool scanNextToken();
-	bool scanNextToken (EToken tok);
-	void mustScanNext (EToken tok);
+	void	mustScanNext (EToken tok);
+	bool	scanNextToken();
+	bool	scanNextToken (EToken tok);
+	QString	token() const;
+	bool	tokenEquals (const QString& text) const;
 
 private:
-	bool checkString (const char* c, bool peek = false);
+	const char*	find (const char* text, int length) const;
+	bool		scanNamedToken (EToken tok, int length);
+	void		setToken (EToken tok, const char* start, int length);
+	void		skipIgnored();
+	bool		startsWith (const char* text, int length) const;
 };
 
 #endif // LIBCOBALTCORE_XML_SCANNER_H
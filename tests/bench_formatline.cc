@@ -0,0 +1,41 @@
+#include <QDateTime>
+#include "testing.h"
+#include "context.h"
+
+// =============================================================================
+//
+// Turns lines with a typical mix of formatting codes into layout text and
+// format ranges, as the output view does for every line it lays out.
+//
+int main()
+{
+	const int count = 200000;
+	const qint64 now = QDateTime::currentMSecsSinceEpoch();
+	QVector<ContextLine> lines;
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		ContextLine line;
+		line.time = now + i * 1500;
+		line.text = format ("<" BOLD_STR "nick%1" BOLD_STR "> " NORMAL_STR "message " COLOR_STR
+			"04,01number" COLOR_STR " %1 with " UNDERLINE_STR "some" UNDERLINE_STR " plain text "
+			"after the formatting, as most of a line usually is", i).toUtf8();
+		lines << line;
+	}
+
+	QString text;
+	QList<QTextLayout::FormatRange> formats;
+	qint64 characterCount = 0;
+	QElapsedTimer timer;
+	timer.start();
+
+	for (int i = 0; i < count; ++i)
+	{
+		Context::formatLine (lines[i % lines.size()], text, formats);
+		characterCount += text.size();
+	}
+
+	reportBenchmark ("formatting lines", timer, count, "lines");
+	reportBenchmark ("formatting characters", timer, characterCount, "characters");
+	return 0;
+}
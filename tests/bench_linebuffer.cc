@@ -0,0 +1,55 @@
+#include <cstring>
+#include "testing.h"
+#include "linebuffer.h"
+
+// =============================================================================
+//
+// Frames a stream of typical IRC lines arriving in reads of varying sizes,
+// like a socket delivers them, and counts the lines that come out.
+//
+int main()
+{
+	const int rounds = 20;
+	QByteArray stream;
+
+	for (int i = 0; i < 100000; ++i)
+	{
+		stream += format (":nick%1!user@host.example.net PRIVMSG #channel :message number %1 "
+			"with some text in it\r\n", i).toUtf8();
+	}
+
+	LineBuffer buffer;
+	qint64 lineCount = 0;
+	qint64 byteCount = 0;
+	QElapsedTimer timer;
+	timer.start();
+
+	for (int round = 0; round < rounds; ++round)
+	{
+		int readSize = 512;
+
+		for (int position = 0; position < stream.size();)
+		{
+			const int length = qMin (readSize, stream.size() - position);
+			int space;
+			char* data = buffer.prepareWrite (length, space);
+			memcpy (data, stream.constData() + position, length);
+			buffer.commitWrite (length);
+			position += length;
+			const char* line;
+			int lineLength;
+
+			while (buffer.nextLine (line, lineLength))
+				lineCount++;
+
+			// Vary the read size between 512 and 4096 bytes.
+			readSize = 512 + (readSize * 7) % 3584;
+		}
+
+		byteCount += stream.size();
+	}
+
+	reportBenchmark ("framing lines", timer, lineCount, "lines");
+	reportBenchmark ("framing bytes", timer, byteCount, "bytes");
+	return 0;
+}
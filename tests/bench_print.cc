@@ -0,0 +1,33 @@
+#include <QApplication>
+#include "testing.h"
+#include "connection.h"
+#include "context.h"
+#include "mainwindow.h"
+
+// =============================================================================
+//
+// Prints messages into the context being displayed, then lets the output view
+// catch up with them once, as it does at the end of an event loop turn.
+//
+int main (int argc, char* argv[])
+{
+	QApplication app (argc, argv);
+	const int count = 200000;
+	(new MainWindow)->show();
+	IRCConnection* connection = new IRCConnection ("irc.example.net", 6667);
+	Context::setCurrentContext (connection->context);
+	QElapsedTimer timer;
+	timer.start();
+
+	for (int i = 0; i < count; ++i)
+	{
+		connection->context->writeIRCMessage (format ("nick%1", i % 50),
+			format ("message number %1 with " BOLD_STR "some" BOLD_STR " text in it", i));
+	}
+
+	reportBenchmark ("appending lines", timer, count, "lines");
+	timer.restart();
+	app.processEvents();
+	reportBenchmark ("updating the view", timer, count, "lines");
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include "testing.h"
+#include "searchindex.h"
+
+// =============================================================================
+//
+// Indexes generated lines the way the log writer does, flushing and merging
+// runs as they fill up, then searches them for common and rare words.
+//
+int main()
+{
+	const QString directory = makeScratchDirectory ("bench-search");
+	const int lineCount = 1000000;
+	const int searchCount = 1000;
+	SearchIndex* index = new SearchIndex (directory);
+	index->load();
+	QStringList words;
+
+	for (int i = 0; i < 5000; ++i)
+		words << format ("word%1", i);
+
+	QElapsedTimer timer;
+	timer.start();
+
+	for (int i = 0; i < lineCount; ++i)
+	{
+		// Word frequencies fall off roughly like in real text.
+		const QString text = format ("%1 %2 %3 %4", words[i % 10], words[i % 100],
+			words[(i * 7) % 1000], words[(i * 13) % words.size()]);
+		index->addLine (format ("irc.example.net/#channel%1", i % 20), 0, i * 100,
+			format ("nick%1", i % 300), text.toUtf8());
+
+		if (index->isFull())
+		{
+			index->flush();
+			index->mergeRuns();
+		}
+	}
+
+	index->flush();
+	index->mergeRuns();
+	reportBenchmark ("indexing lines", timer, lineCount, "lines");
+
+	const QList<QStringList> queries = QList<QStringList>()
+		<< (QStringList() << "word3")
+		<< (QStringList() << "word3" << "word42")
+		<< (QStringList() << "word4999")
+		<< (QStringList() << SearchIndex::nickTerm ("nick7") << "word5");
+	qint64 hitCount = 0;
+	timer.restart();
+
+	for (int i = 0; i < searchCount; ++i)
+		hitCount += index->search (queries[i % queries.size()], QString(), 50).size();
+
+	reportBenchmark ("searching", timer, searchCount, "searches");
+	print ("%1 hits\n", double (hitCount));
+	delete index;
+	removeScratchDirectory (directory);
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <QFileInfo>
+#include "testing.h"
+#include "xml_document.h"
+#include "xml_node.h"
+
+// =============================================================================
+//
+// Loads a generated configuration of about 10 MB, with the thousands of
+// server, ignore and highlight entries that make big configs slow to load.
+//
+int main()
+{
+	const QString directory = makeScratchDirectory ("bench-xml");
+	const QString path = directory + "/config.xml";
+	XMLDocument* document = XMLDocument::newDocument ("config");
+	XMLNode* servers = document->root->addSubNode ("servers", "");
+	XMLNode* ignores = document->root->addSubNode ("ignores", "");
+	XMLNode* highlights = document->root->addSubNode ("highlights", "");
+
+	for (int i = 0; i < 40000; ++i)
+	{
+		XMLNode* server = servers->addSubNode ("server", "");
+		server->setAttribute ("name", format ("Network %1", i));
+		server->addSubNode ("hostname", format ("irc%1.example.net", i));
+		server->addSubNode ("port", "6667");
+		server->addSubNode ("quitmessage", "Leaving & see you <soon>");
+		ignores->addSubNode ("ignore", format ("*!*@host%1.example.net", i));
+		highlights->addSubNode ("highlight", format ("word%1", i));
+	}
+
+	const bool isSaved = document->saveToFile (path);
+	delete document;
+
+	if (isSaved == false)
+	{
+		fprint (stderr, "couldn't write %1\n", path);
+		return 1;
+	}
+
+	const qint64 size = QFileInfo (path).size();
+	const int rounds = 5;
+	QElapsedTimer timer;
+	timer.start();
+
+	for (int i = 0; i < rounds; ++i)
+	{
+		document = XMLDocument::loadFromFile (path);
+
+		if (document == null)
+		{
+			fprint (stderr, "couldn't load %1: %2\n", path, XMLDocument::getParseError());
+			return 1;
+		}
+
+		delete document;
+	}
+
+	reportBenchmark ("loading a config", timer, rounds * size, "bytes");
+	removeScratchDirectory (directory);
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include <cstring>
+#include "testing.h"
+#include "linebuffer.h"
+
+// =============================================================================
+//
+// Writes @text into @buffer as if it came in with one read.
+//
+static void receive (LineBuffer& buffer, const char* text)
+{
+	const int length = strlen (text);
+	int space;
+	char* data = buffer.prepareWrite (length, space);
+	memcpy (data, text, length);
+	buffer.commitWrite (length);
+}
+
+// =============================================================================
+//
+// Takes the next line out of @buffer into @out. Returns false if there is no
+// complete line.
+//
+static bool takeLine (LineBuffer& buffer, QByteArray& out)
+{
+	const char* line;
+	int length;
+
+	if (buffer.nextLine (line, length) == false)
+		return false;
+
+	out = QByteArray (line, length);
+	return true;
+}
+
+// =============================================================================
+//
+static void testPartialLine()
+{
+	LineBuffer buffer;
+	QByteArray line;
+	receive (buffer, "PING :irc.exa");
+	CHECK (takeLine (buffer, line) == false);
+	receive (buffer, "mple.net\r\n:nick PRIV");
+	CHECK (takeLine (buffer, line) && line == "PING :irc.example.net");
+	CHECK (takeLine (buffer, line) == false);
+	receive (buffer, "MSG #chan :hi\n");
+	CHECK (takeLine (buffer, line) && line == ":nick PRIVMSG #chan :hi");
+	CHECK (takeLine (buffer, line) == false);
+	CHECK (buffer.pendingBytes() == 0);
+}
+
+// =============================================================================
+//
+static void testSplitCRLF()
+{
+	LineBuffer buffer;
+	QByteArray line;
+	receive (buffer, "PING :a\r");
+	CHECK (takeLine (buffer, line) == false);
+	receive (buffer, "\nPING :b\r\n");
+	CHECK (takeLine (buffer, line) && line == "PING :a");
+	CHECK (takeLine (buffer, line) && line == "PING :b");
+	CHECK (takeLine (buffer, line) == false);
+}
+
+// =============================================================================
+//
+// A line longer than the buffer makes it grow, and nothing comes out until the
+// line is complete.
+//
+static void testNoNewline()
+{
+	LineBuffer buffer (16);
+	QByteArray line;
+	const QByteArray text (1000, 'x');
+	receive (buffer, text.constData());
+	CHECK (takeLine (buffer, line) == false);
+	CHECK (buffer.pendingBytes() == text.size());
+	receive (buffer, "\n");
+	CHECK (takeLine (buffer, line) && line == text);
+}
+
+// =============================================================================
+//
+int main()
+{
+	testPartialLine();
+	testSplitCRLF();
+	testNoNewline();
+	return testResult();
+}
@@ -0,0 +1,81 @@
+#include "testing.h"
+#include "sendqueue.h"
+#include "config.h"
+
+EXTERN_CONFIG (Int, flood_penalty)
+EXTERN_CONFIG (Int, flood_window)
+
+// =============================================================================
+//
+// Once bulk traffic has used up the flood window, a PONG is still sent at once
+// rather than after the bulk lines queued before it.
+//
+static void testBulkDoesNotStarveHigh()
+{
+	SendQueue queue;
+	QByteArray out;
+
+	for (int i = 0; i < 100; ++i)
+		queue.enqueue ("WHO #channel\r\n", SendPriority_Bulk);
+
+	CHECK (queue.takeAllowed (out, 0) > 0);
+	CHECK (queue.depth() == 100 - cfg::flood_window / cfg::flood_penalty);
+
+	out.clear();
+	queue.enqueue ("PONG :irc.example.net\r\n", SendPriority_High);
+	queue.takeAllowed (out, 0);
+	CHECK (out == "PONG :irc.example.net\r\n");
+
+	// The bulk lines go on once the window allows it.
+	out.clear();
+	const qint64 wait = queue.takeAllowed (out, 0);
+	CHECK (out.isEmpty() && wait > 0);
+	queue.takeAllowed (out, wait + cfg::flood_penalty);
+	CHECK (out.startsWith ("WHO"));
+}
+
+// =============================================================================
+//
+// However long the bulk traffic keeps coming, every PONG gets out by the time
+// the next line of any kind may be sent.
+//
+static void testHighKeepsGettingThrough()
+{
+	SendQueue queue;
+	qint64 now = 0;
+
+	for (int i = 0; i < 100; ++i)
+		queue.enqueue ("WHO #channel\r\n", SendPriority_Bulk);
+
+	for (int round = 0; round < 20; ++round)
+	{
+		QByteArray out;
+		queue.enqueue ("WHO #channel\r\n", SendPriority_Bulk);
+		queue.enqueue ("PONG :irc.example.net\r\n", SendPriority_High);
+		now += queue.takeAllowed (out, now);
+		CHECK (out.startsWith ("PONG"));
+	}
+}
+
+// =============================================================================
+//
+static void testPriorityOrder()
+{
+	SendQueue queue;
+	QByteArray out;
+	queue.enqueue ("WHO #channel\r\n", SendPriority_Bulk);
+	queue.enqueue ("PRIVMSG #channel :hi\r\n", SendPriority_Normal);
+	queue.enqueue ("PONG :irc.example.net\r\n", SendPriority_High);
+	CHECK (queue.takeAllowed (out, 0) == 0);
+	CHECK (out == "PONG :irc.example.net\r\nPRIVMSG #channel :hi\r\nWHO #channel\r\n");
+}
+
+// =============================================================================
+//
+int main()
+{
+	testBulkDoesNotStarveHigh();
+	testHighKeepsGettingThrough();
+	testPriorityOrder();
+	return testResult();
+}
@@ -0,0 +1,89 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include "testing.h"
+
+const char* configname = UNIXNAME "-test.xml";
+static int g_failedChecks = 0;
+
+// =============================================================================
+//
+QString getVersionString()
+{
+	return "test";
+}
+
+// =============================================================================
+//
+void checkCondition (bool condition, const char* file, int line, const char* expression)
+{
+	if (condition == false)
+	{
+		fprint (stderr, "%1:%2: check failed: %3\n", file, line, expression);
+		g_failedChecks++;
+	}
+}
+
+// =============================================================================
+//
+// Returns the exit code of a test: 0 if every check passed.
+//
+int testResult()
+{
+	if (g_failedChecks == 0)
+		return 0;
+
+	fprint (stderr, "%1 checks failed\n", g_failedChecks);
+	return 1;
+}
+
+// =============================================================================
+//
+// Prints how long the @count items, e.g. lines or bytes, took since @timer was
+// started, and how many were handled per second.
+//
+void reportBenchmark (const char* name, const QElapsedTimer& timer, qint64 count, const char* unit)
+{
+	const double nsecs = qMax<double> (timer.nsecsElapsed(), 1);
+	print ("%1: %2 %3 in %4 ms, %5 ns per %6, %7 %3 per second\n", name, double (count), unit,
+		nsecs / 1e6, nsecs / count, unit, count * 1e9 / nsecs);
+}
+
+// =============================================================================
+//
+// Creates an empty directory for a test or benchmark to write files into.
+//
+QString makeScratchDirectory (const QString& name)
+{
+	const QString path = format ("%1/%2-%3-%4", QDir::tempPath(), UNIXNAME, name,
+		int (QCoreApplication::applicationPid()));
+	removeScratchDirectory (path);
+	QDir().mkpath (path);
+	return path;
+}
+
+// =============================================================================
+//
+void removeScratchDirectory (const QString& path)
+{
+	QDirIterator it (path, QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden,
+		QDirIterator::Subdirectories);
+	QStringList directories;
+
+	while (it.hasNext())
+	{
+		const QString entry = it.next();
+
+		if (it.fileInfo().isDir())
+			directories.prepend (entry);
+		else
+			QFile::remove (entry);
+	}
+
+	// Deepest first, since subdirectories are listed after their parents.
+	for (const QString& directory : directories)
+		QDir().rmdir (directory);
+
+	QDir().rmdir (path);
+}
@@ -0,0 +1,20 @@
+#ifndef SPEECHBUBBLE_TESTING_H
+#define SPEECHBUBBLE_TESTING_H
+
+#include <QElapsedTimer>
+#include "main.h"
+
+// =============================================================================
+//
+// Checks @A in a test. A failed check is reported and counted, and the test
+// goes on so that one run shows every failure.
+//
+#define CHECK(A) checkCondition ((A), __FILE__, __LINE__, #A)
+
+void	checkCondition (bool condition, const char* file, int line, const char* expression);
+QString	makeScratchDirectory (const QString& name);
+void	removeScratchDirectory (const QString& path);
+void	reportBenchmark (const char* name, const QElapsedTimer& timer, qint64 count, const char* unit);
+int		testResult();
+
+#endif // SPEECHBUBBLE_TESTING_H